@@ -0,0 +1,214 @@
+/*
+  Copyright (C) 2017 Hoyoung Lee
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Integrals of bands too large for 32-bit sizes, strides and indices, on
+// views over sparse anonymous mappings: pages which are never written take
+// no memory, and read back as zeros. Linux only. From the top directory:
+//
+// g++ -O3 -I. -DUSE_SIMD -mavx2 -mfma bench/gigapixel.cpp -o gigapixel -pthread
+//
+// ./gigapixel [width]
+//
+// 1. A row of width pixels, 2^31 + 4160 by default, integrated into a
+//    modular uint8_t integral, which checks the sizes of the integrator
+//    past 2^31. It takes about 2 * width bytes: the integral and the zero
+//    line of the integrator.
+// 2. A 4096 x 3 x 2 region at x = 2^32 of a band 2^32 + 8192 pixels wide,
+//    integrated into a uint32_t integral, which checks the offsets of
+//    getView() and getLine() past 2^32 bytes.
+// 3. A 46400 x 46400 band, 2^31 + 5.8M pixels, through integratePixmap()
+//    and integratePixmapStrips(), checked with sumBox() at the far corner,
+//    in the middle and over the whole band. The uint8_t integral keeps it
+//    in 2.2 GB; it wraps around modulo 256, and so do the box sums, which
+//    are compared modulo 256.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <vector>
+#include <sys/mman.h>
+
+#include <cpixmap.hpp>
+#include <integral_image.hpp>
+#include <integral_image.modular.hpp>
+
+template <typename T>
+T *mapSparse(size_t bytes)
+{
+  void *p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (p == MAP_FAILED) {
+    std::perror("mmap");
+    std::exit(EXIT_FAILURE);
+  }
+  return reinterpret_cast<T *>(p);
+}
+
+double getSeconds(std::chrono::steady_clock::time_point t0)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// One pixel of value 1 every 1 MB and on both sides of 2^31, integrated
+// modulo 256
+bool integrateWideRow(size_t width)
+{
+  uint8_t *pixels = mapSparse<uint8_t>(width);
+  uint8_t *integrals = mapSparse<uint8_t>(width);
+  cpixmap<uint8_t> pixmap(pixels, width, 1, 1, ALIGN_BYTES(width));
+  cpixmap<uint8_t> integral(integrals, width, 1, 1, ALIGN_BYTES(width));
+
+  const size_t edge = (size_t)1 << 31;
+  for (size_t x = 0; x < width; x += (size_t)1 << 20) pixmap.getPixel(x, 0) = 1;
+  for (size_t x = edge - 2; x < edge + 2 && x < width; ++x) pixmap.getPixel(x, 0) = 1;
+  pixmap.getPixel(width - 1, 0) = 1;
+
+  const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+  integratePixmapModular(pixmap, integral);
+  const double seconds = getSeconds(t0);
+
+  uint8_t sum = 0;
+  size_t x = 0;
+  for (; x < width; ++x) {
+    sum += pixels[x];
+    if (integrals[x] != sum) break;
+  }
+  std::printf("%zu x 1 u8->u8:  %.2f s, %.2f Gpx/s, %s\n", width, seconds, width / seconds * 1e-9,
+	      x == width ? "ok" : "MISMATCH");
+  if (x < width) std::printf("  first mismatch at x = %zu\n", x);
+
+  munmap(pixels, width);
+  munmap(integrals, width);
+  return x == width;
+}
+
+bool integrateFarRegion(void)
+{
+  const size_t width = ((size_t)1 << 32) + 8192, height = 3, bands = 2;
+  const size_t x0 = (size_t)1 << 32, cols = 4096;
+  const size_t bytes = width * height * bands;
+  uint8_t *pixels = mapSparse<uint8_t>(bytes);
+  cpixmap<uint8_t> band(pixels, width, height, bands, width);
+
+  // Pixels on both sides of the region, which only those inside may reach
+  for (size_t z = 0; z < bands; ++z) {
+    for (size_t y = 0; y < height; ++y) {
+      for (size_t x = x0 - 64; x < x0 + cols + 64; ++x) band.getPixel(x, y, z) = (uint8_t)(x * 7 + y * 3 + z);
+    }
+  }
+
+  cpixmap<uint8_t> view = band.getView(cregion<size_t>(x0, 0, 0, cols, height, bands));
+  cpixmap<uint32_t> integral(cols, height, bands);
+  integratePixmap(view, integral);
+
+  bool matched = view.getLine(0, 1) == pixels + width * height + x0;
+  for (size_t z = 0; z < bands; ++z) {
+    std::vector<uint32_t> sumLine(cols, 0);
+    for (size_t y = 0; y < height; ++y) {
+      const uint8_t *pixLine = pixels + (z * height + y) * width + x0;
+      uint32_t sum = 0;
+      for (size_t x = 0; x < cols; ++x) {
+	sum += pixLine[x];
+	sumLine[x] += sum;
+	matched &= integral.getPixel(x, y, z) == sumLine[x];
+      }
+    }
+  }
+  std::printf("%zu x %zu x %zu region at x = %zu of a %zu wide band: %s\n",
+	      cols, height, bands, x0, width, matched ? "ok" : "MISMATCH");
+
+  munmap(pixels, bytes);
+  return matched;
+}
+
+// Sum of the w x h box at (x, y), straight from the pixels
+uint64_t sumPixels(const cpixmap<uint8_t>& pixmap, size_t x, size_t y, size_t w, size_t h)
+{
+  uint64_t sum = 0;
+  for (size_t j = y; j < y + h; ++j) {
+    for (size_t i = x; i < x + w; ++i) sum += pixmap.getPixel(i, j);
+  }
+  return sum;
+}
+
+// Boxes at the corners of the plane, across its middle and over all of it.
+// The integral wraps around modulo 256, and so do the box sums.
+bool checkBoxes(const cpixmap<uint8_t>& pixmap, const cpixmap<uint8_t>& integral, uint64_t total)
+{
+  const size_t side = pixmap.getWidth(), far = side - 96, mid = side / 2 - 48;
+  bool matched = sumBox(integral, far, far, 96, 96) == (uint8_t)sumPixels(pixmap, far, far, 96, 96);
+  matched &= sumBox(integral, side - 1, side - 1, 1, 1) == pixmap.getPixel(side - 1, side - 1);
+  matched &= sumBox(integral, mid, mid, 96, 96) == (uint8_t)sumPixels(pixmap, mid, mid, 96, 96);
+  matched &= sumBox(integral, 0, 0, 64, 64) == (uint8_t)sumPixels(pixmap, 0, 0, 64, 64);
+  matched &= sumBox(integral, 0, 0, side, side) == (uint8_t)total;
+  return matched;
+}
+
+// A side x side plane of more than 2^31 pixels, through integratePixmap()
+// and integratePixmapStrips(). Its pixels are zero but for three blocks and
+// one pixel every 1 MB, so that only the integral takes memory.
+bool integrateLargeBand(size_t side)
+{
+  const size_t bytes = side * side;
+  uint8_t *pixels = mapSparse<uint8_t>(bytes);
+  uint8_t *integrals = mapSparse<uint8_t>(bytes);
+  cpixmap<uint8_t> pixmap(pixels, side, side, 1, side);
+  cpixmap<uint8_t> integral(integrals, side, side, 1, side);
+
+  uint64_t total = 0;
+  for (size_t i = (size_t)1 << 19; i < bytes; i += (size_t)1 << 20) {
+    pixels[i] = 1;
+    ++total;
+  }
+  const size_t blocks[] = { 0, side / 2 - 32, side - 64 };
+  for (size_t b = 0; b < 3; ++b) {
+    for (size_t y = blocks[b]; y < blocks[b] + 64; ++y) {
+      for (size_t x = blocks[b]; x < blocks[b] + 64; ++x) {
+	total -= pixmap.getPixel(x, y);
+	total += pixmap.getPixel(x, y) = (uint8_t)((x ^ y) & 3);
+      }
+    }
+  }
+
+  std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+  integratePixmap(pixmap, integral);
+  double seconds = getSeconds(t0);
+  bool matched = checkBoxes(pixmap, integral, total);
+  std::printf("%zu x %zu integratePixmap:       %.2f s, %s\n", side, side, seconds, matched ? "ok" : "MISMATCH");
+
+  // The last row goes first, so that a strip left out shows
+  std::memset(integrals + bytes - side, 0, side);
+  t0 = std::chrono::steady_clock::now();
+  integratePixmapStrips(pixmap, integral, 4);
+  seconds = getSeconds(t0);
+  const bool stripsMatched = checkBoxes(pixmap, integral, total);
+  std::printf("%zu x %zu integratePixmapStrips: %.2f s, %s\n", side, side, seconds, stripsMatched ? "ok" : "MISMATCH");
+
+  munmap(pixels, bytes);
+  munmap(integrals, bytes);
+  return matched && stripsMatched;
+}
+
+int main(int argc, char *argv[])
+{
+  const size_t width = argc > 1 ? std::strtoull(argv[1], NULL, 10) : ((size_t)1 << 31) + 4160;
+  bool matched = integrateWideRow(width);
+  matched &= integrateFarRegion();
+  matched &= integrateLargeBand(46400);
+  return matched ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,117 @@
+/*
+  Copyright (C) 2017 Hoyoung Lee
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// integratePixmap() against the scalar recurrence it replaced,
+//   I(x, y) = I(x, y-1) - I(x-1, y-1) + I(x-1, y) + p(x, y)
+// on one thread. Without -DUSE_SIMD, integratePixmap() takes its scalar
+// kernels. Build it once per instruction set from the top directory:
+//
+// g++ -O3 -I. -DUSE_SIMD -msse2 bench/integrate.cpp -o integrate.sse2 -pthread
+// g++ -O3 -I. -DUSE_SIMD -mavx2 -mfma bench/integrate.cpp -o integrate.avx2 -pthread
+// g++ -O3 -I. -DUSE_SIMD -mavx512f -mavx512bw -mavx512dq -mavx512vl -mfma
+//     bench/integrate.cpp -o integrate.avx512 -pthread
+//
+// ./integrate.avx2 [width height [repeats]]   (3840 x 2160, 20 by default)
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <chrono>
+#include <algorithm>
+
+#include <cpixmap.hpp>
+#include <cexecutor.hpp>
+#include <integral_image.hpp>
+
+// The integrator as it was: the recurrence on two temporary lines with a
+// zero at index -1, each row then copied out into the integral.
+template <typename pixel_t, typename integral_t>
+void integratePixmapRecurrence(cpixmap<pixel_t>& pixmap, cpixmap<integral_t>& integral)
+{
+  const size_t width = pixmap.getWidth();
+  integral_t *temp1Line = new integral_t[width + 1]();
+  integral_t *temp2Line = new integral_t[width + 1]();
+  for (size_t z = 0; z < pixmap.getBands(); ++z) {
+    std::fill(temp1Line, temp1Line + width + 1, integral_t(0));
+    integral_t *prevLine = temp1Line + 1, *currLine = temp2Line + 1;
+    for (size_t y = 0; y < pixmap.getHeight(); ++y) {
+      const pixel_t *pixLine = pixmap.getLine(y, z);
+      for (size_t x = 0; x < width; ++x)
+	currLine[(int)x] = prevLine[(int)x] - prevLine[(int)x-1] + currLine[(int)x-1] + (integral_t)pixLine[x];
+      integral.writeHLine(currLine, width, 0, y, z);
+      std::swap(prevLine, currLine);
+    }
+  }
+  delete [] temp1Line;
+  delete [] temp2Line;
+}
+
+template <typename F>
+double getBestMilliseconds(F f, size_t repeats)
+{
+  double best = 1e30;
+  for (size_t i = 0; i < repeats; ++i) {
+    const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    f();
+    const std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    best = std::min(best, std::chrono::duration<double, std::milli>(t1 - t0).count());
+  }
+  return best;
+}
+
+template <typename pixel_t, typename integral_t>
+bool benchmark(const char *name, size_t width, size_t height, size_t repeats)
+{
+  cpixmap<pixel_t> pixmap(width, height);
+  cpixmap<integral_t> reference(width, height), integral(width, height);
+  uint32_t seed = 1;
+  for (size_t y = 0; y < height; ++y) {
+    pixel_t *pixLine = pixmap.getLine(y);
+    for (size_t x = 0; x < width; ++x) {
+      seed = seed * 1664525 + 1013904223;
+      pixLine[x] = (pixel_t)(seed >> 24);
+    }
+  }
+
+  cserialexecutor executor;
+  const double tr = getBestMilliseconds([&] { integratePixmapRecurrence(pixmap, reference); }, repeats);
+  const double tv = getBestMilliseconds([&] { integratePixmap(pixmap, integral, executor); }, repeats);
+
+  bool matched = true;
+  for (size_t y = 0; y < height && matched; ++y)
+    matched = !std::memcmp(reference.getLine(y), integral.getLine(y), width * sizeof(integral_t));
+  std::printf("%-9s recurrence %8.2f ms, integratePixmap %8.2f ms, x%.1f%s\n",
+	      name, tr, tv, tr / tv, matched ? "" : "  MISMATCH");
+  return matched;
+}
+
+int main(int argc, char *argv[])
+{
+  const size_t width = argc > 2 ? std::strtoul(argv[1], NULL, 10) : 3840;
+  const size_t height = argc > 2 ? std::strtoul(argv[2], NULL, 10) : 2160;
+  const size_t repeats = argc > 3 ? std::strtoul(argv[3], NULL, 10) : 20;
+
+  std::printf("%zu x %zu, best of %zu, 1 thread\n", width, height, repeats);
+  bool matched = true;
+  matched &= benchmark<uint8_t, uint32_t>("u8->u32", width, height, repeats);
+  matched &= benchmark<uint16_t, uint32_t>("u16->u32", width, height, repeats);
+  matched &= benchmark<uint16_t, uint64_t>("u16->u64", width, height, repeats);
+  matched &= benchmark<int16_t, int64_t>("s16->s64", width, height, repeats);
+  matched &= benchmark<float, double>("f32->f64", width, height, repeats);
+  return matched ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,92 @@
+/*
+  Copyright (C) 2017 Hoyoung Lee
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Column walks over float pixmaps with and without PAD_STRIDE, for row
+// strides on multiples of 4 KB and for widths next to them, on one thread.
+// From the top directory:
+//
+// g++ -O3 -I. -DUSE_SIMD -mavx2 -mfma bench/stride.cpp -o stride -pthread
+//
+// ./stride [height [repeats]]   (1024 rows, best of 7 by default)
+//
+// readVLine() walks every column, flipVertically() swaps rows, and the
+// slow integrator runs its vertical pass on chunks of columns.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+#include <cpixmap.hpp>
+#include <cexecutor.hpp>
+#include <integral_image.slow.hpp>
+
+template <typename F>
+double getBestMilliseconds(F f, size_t repeats)
+{
+  double best = 1e30;
+  for (size_t i = 0; i < repeats; ++i) {
+    const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    f();
+    const std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    best = std::min(best, std::chrono::duration<double, std::milli>(t1 - t0).count());
+  }
+  return best;
+}
+
+int main(int argc, char *argv[])
+{
+  const size_t height = argc > 1 ? std::strtoul(argv[1], NULL, 10) : 1024;
+  const size_t repeats = argc > 2 ? std::strtoul(argv[2], NULL, 10) : 7;
+  const size_t widths[] = { 1024, 1000, 2048, 2000, 4096, 4000 };
+  cserialexecutor executor;
+
+  std::printf("%zu rows, best of %zu, 1 thread\n", height, repeats);
+  std::printf("%6s %6s %8s %16s %12s %14s\n", "width", "padded", "stride", "readVLine MB/s", "flipV MB/s", "slow int. ms");
+  for (size_t i = 0; i < sizeof(widths) / sizeof(widths[0]); ++i) {
+    const size_t width = widths[i];
+    for (int padded = 0; padded < 2; ++padded) {
+      // Odd widths get no padding: their strides are not on 512 bytes
+      if (padded && width % 128 != 0) continue;
+      const int allocation = cpixmap<float>::ZERO_FILL | (padded ? cpixmap<float>::PAD_STRIDE : 0);
+      cpixmap<float> pixmap(width, height, 1, allocation);
+      cpixmap<double> integral(width, height, 1, allocation);
+      for (size_t y = 0; y < height; ++y) {
+	float *pixLine = pixmap.getLine(y);
+	for (size_t x = 0; x < width; ++x) pixLine[x] = (float)((x ^ y) & 15);
+      }
+
+      std::vector<float> column(height);
+      volatile float sink = 0;
+      const double tr = getBestMilliseconds([&] {
+	  for (size_t x = 0; x < width; ++x) {
+	    pixmap.readVLine(column.data(), height, x, 0);
+	    sink = sink + column[height - 1];
+	  }
+	}, repeats);
+      const double tf = getBestMilliseconds([&] { pixmap.flipVertically(); }, repeats);
+      const double ti = getBestMilliseconds([&] { integratePixmap(pixmap, integral, executor); }, repeats);
+
+      const double mb = width * height * sizeof(float) * 1e-6;
+      std::printf("%6zu %6s %8zu %16.0f %12.0f %14.2f\n", width, padded ? "yes" : "no",
+		  pixmap.getLineStride(), mb / tr * 1e3, mb / tf * 1e3, ti);
+    }
+  }
+  return EXIT_SUCCESS;
+}
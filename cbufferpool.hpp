@@ -0,0 +1,161 @@
+/*
+  Copyright (C) 2017 Hoyoung Lee
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <mutex>
+#include <vector>
+#if defined(_WIN32)
+# include <malloc.h>
+#endif
+#if defined(__linux__)
+# include <sys/mman.h>
+#endif
+
+#include "power_of_2.hpp"
+
+#define HUGE_PAGE_BYTES ((size_t)2 << 20)
+
+// Buffer on a cache line or, with hugePages and 2 MB or more, on a 2 MB
+// boundary that Linux is asked to back with transparent huge pages.
+inline uint8_t *allocateBuffer(size_t bytes, bool hugePages)
+{
+  const bool huge = hugePages && bytes >= HUGE_PAGE_BYTES;
+  const size_t alignment = huge ? HUGE_PAGE_BYTES : 64;
+  if (huge) bytes = (bytes + HUGE_PAGE_BYTES - 1) & ~(HUGE_PAGE_BYTES - 1);
+
+  void *buffer = NULL;
+#if defined(_WIN32)
+  buffer = _aligned_malloc(std::max<size_t>(bytes, 1), alignment);
+#else
+  if (posix_memalign(&buffer, alignment, std::max<size_t>(bytes, 1)) != 0) buffer = NULL;
+#endif
+  assert(buffer);
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+  if (huge) madvise(buffer, bytes, MADV_HUGEPAGE);
+#endif
+  return reinterpret_cast<uint8_t *>(buffer);
+}
+
+inline void releaseBuffer(uint8_t *buffer)
+{
+#if defined(_WIN32)
+  _aligned_free(buffer);
+#else
+  free(buffer);
+#endif
+}
+
+// Thread-safe cache of buffers, in power-of-2 size classes, for the
+// pixmaps and the temporary lines which are allocated again for every
+// frame of a video. acquire() takes a free buffer of the size class of
+// bytes or allocates one of the whole class, and release() gives it back
+// to its class. A loop over frames of the same size then allocates on its
+// first frame only. The untouched tail of a class is address space, not
+// memory, as long as nothing writes there.
+//
+// At most maxCachedBytes are kept free; buffers released past that are
+// freed, as are all the free buffers on trim() and on destruction.
+
+class cbufferpool {
+public:
+  cbufferpool(size_t maxCachedBytes = (size_t)1 << 30)
+    : m_cached_bytes(0), m_max_cached_bytes(maxCachedBytes) {}
+  ~cbufferpool(void) { trim(); }
+  // A buffer of getCapacity(bytes) bytes
+  uint8_t *acquire(size_t bytes, bool hugePages = false);
+  // Gives back a buffer acquired with the same bytes and hugePages
+  void release(uint8_t *buffer, size_t bytes, bool hugePages = false);
+  void trim(void);
+  size_t getCachedBytes(void) const;
+  static size_t getCapacity(size_t bytes) { return (size_t)1 << getSizeClass(bytes); }
+
+private:
+  cbufferpool(const cbufferpool&);
+  cbufferpool& operator=(const cbufferpool&);
+
+  static size_t getSizeClass(size_t bytes);
+
+  mutable std::mutex m_mutex;
+  std::vector<uint8_t *> m_free[2][64];  // [hugePages][size class]
+  size_t m_cached_bytes;
+  size_t m_max_cached_bytes;
+};
+
+inline size_t cbufferpool::getSizeClass(size_t bytes)
+{
+  assert(bytes <= ((size_t)1 << 62));
+  return ilog2(ceilPowerOf2(std::max<size_t>(bytes, 64)));
+}
+
+inline uint8_t *cbufferpool::acquire(size_t bytes, bool hugePages)
+{
+  const size_t c = getSizeClass(bytes);
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<uint8_t *>& buffers = m_free[hugePages][c];
+    if (!buffers.empty()) {
+      uint8_t *buffer = buffers.back();
+      buffers.pop_back();
+      m_cached_bytes -= (size_t)1 << c;
+      return buffer;
+    }
+  }
+  return allocateBuffer((size_t)1 << c, hugePages);
+}
+
+inline void cbufferpool::release(uint8_t *buffer, size_t bytes, bool hugePages)
+{
+  if (!buffer) return;
+  const size_t c = getSizeClass(bytes);
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_cached_bytes + ((size_t)1 << c) <= m_max_cached_bytes) {
+      m_free[hugePages][c].push_back(buffer);
+      m_cached_bytes += (size_t)1 << c;
+      return;
+    }
+  }
+  releaseBuffer(buffer);
+}
+
+inline void cbufferpool::trim(void)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (size_t h = 0; h < 2; ++h) {
+    for (size_t c = 0; c < 64; ++c) {
+      for (size_t i = 0; i < m_free[h][c].size(); ++i) releaseBuffer(m_free[h][c][i]);
+      m_free[h][c].clear();
+    }
+  }
+  m_cached_bytes = 0;
+}
+
+inline size_t cbufferpool::getCachedBytes(void) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_cached_bytes;
+}
+
+inline cbufferpool& getDefaultBufferPool(void)
+{
+  static cbufferpool pool;
+  return pool;
+}
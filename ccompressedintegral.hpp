@@ -0,0 +1,305 @@
+/*
+  Copyright (C) 2017 Hoyoung Lee
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cassert>
+#include <cstring>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+#include <type_traits>
+
+#include "cregion.hpp"
+#include "cbufferpool.hpp"
+
+// Block-compressed summed-area table.
+//
+// The integral is cut into square tiles of tileSize x tileSize. For the tile
+// at (x0, y0), with B = I(x0-1, y0-1),
+//
+//   I(x0+i, y0+j) = B + top[i] + left[j] + local(i, j)
+//
+// where top[i] = I(x0+i, y0-1) - B and left[j] = I(x0-1, y0+j) - B are the
+// edges coming from the tiles above and on the left, and local(i, j) is the
+// SAT of the pixels of the tile alone. Only B keeps the full width of
+// integral_t. The edges and the local SAT each take the narrowest of 16, 32
+// or sizeof(integral_t)*8 bits that holds them in that tile, so an integral
+// costs 2 to 4 bytes instead of 8 with 8-bit pixels, and a query still
+// reads four values of the table.
+//
+// The tiles of every tile row of a band share one buffer, filled by
+// setStrip() from the rows of the uncompressed SAT.
+
+template <typename integral_t>
+class ccompressedintegral : public cregion<size_t> {
+public:
+  ccompressedintegral(void);
+  ccompressedintegral(size_t w, size_t h, size_t b = 1, size_t tileSize = 16);
+  virtual ~ccompressedintegral(void);
+  void setResolution(size_t w, size_t h, size_t b = 1);
+  void setResolution(size_t w, size_t h, size_t b, size_t tileSize);
+  size_t getTileSize(void) const { return m_tile_size; }
+  size_t getTilesX(void) const { return m_tiles_x; }
+  size_t getTilesY(void) const { return m_tiles_y; }
+  // Bytes taken by the tiles, their descriptors included
+  size_t getBytes(void) const;
+  // I(x, y), the sum of the pixels in [0, x] x [0, y]
+  integral_t getIntegral(size_t x, size_t y, size_t z = 0) const;
+  // Sum of the pixels of the w x h box at (x, y)
+  integral_t sumBox(size_t x, size_t y, size_t w, size_t h, size_t z = 0) const;
+  // Compresses the tile row ty of band z. lines[j] is the SAT row y0+j,
+  // for j < rows, and aboveLine the SAT row y0-1, NULL for ty = 0.
+  void setStrip(size_t ty, size_t z, const integral_t *aboveLine, const integral_t *const *lines, size_t rows);
+
+private:
+  ccompressedintegral(const ccompressedintegral&);
+  ccompressedintegral& operator=(const ccompressedintegral&);
+
+  typedef typename std::conditional<std::numeric_limits<integral_t>::is_signed, int16_t, uint16_t>::type offset16_t;
+  typedef typename std::conditional<std::numeric_limits<integral_t>::is_signed, int32_t, uint32_t>::type offset32_t;
+
+  struct ctile {
+    integral_t base;
+    size_t offset;       // bytes from the start of the strip buffer
+    uint8_t edgeBytes;   // of top[] and left[]
+    uint8_t localBytes;  // of local()
+  };
+
+  void release(void);
+  static integral_t readOffset(const uint8_t *p, size_t i, size_t bytes);
+  static void writeOffsets(uint8_t *p, const integral_t *v, size_t n, size_t bytes);
+  static size_t getOffsetBytes(const integral_t *v, size_t n);
+
+  size_t m_tile_size;
+  size_t m_tile_shift;
+  size_t m_tiles_x;
+  size_t m_tiles_y;
+  ctile *m_tiles;       // [z][ty][tx]
+  uint8_t **m_strips;   // [z][ty]
+  size_t *m_strip_bytes;
+  size_t *m_strip_capacity;
+};
+
+template <typename integral_t>
+ccompressedintegral<integral_t>::ccompressedintegral(void)
+  : m_tile_size(16), m_tile_shift(4), m_tiles_x(0), m_tiles_y(0),
+    m_tiles(NULL), m_strips(NULL), m_strip_bytes(NULL), m_strip_capacity(NULL)
+{
+  static_assert(std::numeric_limits<integral_t>::is_integer, "Only integer integrals are compressed");
+}
+
+template <typename integral_t>
+ccompressedintegral<integral_t>::ccompressedintegral(size_t w, size_t h, size_t b, size_t tileSize)
+  : m_tile_size(16), m_tile_shift(4), m_tiles_x(0), m_tiles_y(0),
+    m_tiles(NULL), m_strips(NULL), m_strip_bytes(NULL), m_strip_capacity(NULL)
+{
+  static_assert(std::numeric_limits<integral_t>::is_integer, "Only integer integrals are compressed");
+  setResolution(w, h, b, tileSize);
+}
+
+template <typename integral_t>
+ccompressedintegral<integral_t>::~ccompressedintegral(void)
+{
+  release();
+}
+
+template <typename integral_t>
+void ccompressedintegral<integral_t>::release(void)
+{
+  if (m_strips) {
+    for (size_t s = 0; s < m_bands * m_tiles_y; ++s) delete [] m_strips[s];
+    delete [] m_strips;
+  }
+  if (m_tiles) delete [] m_tiles;
+  if (m_strip_bytes) delete [] m_strip_bytes;
+  if (m_strip_capacity) delete [] m_strip_capacity;
+  m_strips = NULL;
+  m_tiles = NULL;
+  m_strip_bytes = NULL;
+  m_strip_capacity = NULL;
+}
+
+template <typename integral_t>
+void ccompressedintegral<integral_t>::setResolution(size_t w, size_t h, size_t b)
+{
+  setResolution(w, h, b, m_tile_size);
+}
+
+template <typename integral_t>
+void ccompressedintegral<integral_t>::setResolution(size_t w, size_t h, size_t b, size_t tileSize)
+{
+  assert(tileSize >= 4 && (tileSize & (tileSize - 1)) == 0);
+
+  release();
+  cregion::setResolution(w, h, b);
+  m_tile_size = tileSize;
+  for (m_tile_shift = 0; ((size_t)1 << m_tile_shift) < tileSize; ++m_tile_shift);
+  m_tiles_x = (w + tileSize - 1) >> m_tile_shift;
+  m_tiles_y = (h + tileSize - 1) >> m_tile_shift;
+
+  m_tiles = new ctile[b * m_tiles_y * m_tiles_x];
+  std::memset(m_tiles, 0, b * m_tiles_y * m_tiles_x * sizeof(ctile));
+  m_strips = new uint8_t*[b * m_tiles_y];
+  m_strip_bytes = new size_t[b * m_tiles_y];
+  m_strip_capacity = new size_t[b * m_tiles_y];
+  for (size_t s = 0; s < b * m_tiles_y; ++s) {
+    m_strips[s] = NULL;
+    m_strip_bytes[s] = 0;
+    m_strip_capacity[s] = 0;
+  }
+}
+
+template <typename integral_t>
+size_t ccompressedintegral<integral_t>::getBytes(void) const
+{
+  size_t bytes = m_bands * m_tiles_y * m_tiles_x * sizeof(ctile);
+  for (size_t s = 0; s < m_bands * m_tiles_y; ++s) bytes += m_strip_bytes[s];
+  return bytes;
+}
+
+template <typename integral_t>
+inline integral_t ccompressedintegral<integral_t>::readOffset(const uint8_t *p, size_t i, size_t bytes)
+{
+  switch (bytes) {
+  case 2: return (integral_t)((const offset16_t *)p)[i];
+  case 4: return (integral_t)((const offset32_t *)p)[i];
+  default: return ((const integral_t *)p)[i];
+  }
+}
+
+template <typename integral_t>
+inline void ccompressedintegral<integral_t>::writeOffsets(uint8_t *p, const integral_t *v, size_t n, size_t bytes)
+{
+  switch (bytes) {
+  case 2: for (size_t i = 0; i < n; ++i) ((offset16_t *)p)[i] = (offset16_t)v[i]; break;
+  case 4: for (size_t i = 0; i < n; ++i) ((offset32_t *)p)[i] = (offset32_t)v[i]; break;
+  default: std::memcpy(p, v, n * sizeof(integral_t)); break;
+  }
+}
+
+// Narrowest width keeping every value once narrowed and widened back
+template <typename integral_t>
+inline size_t ccompressedintegral<integral_t>::getOffsetBytes(const integral_t *v, size_t n)
+{
+  bool fits16 = sizeof(offset16_t) < sizeof(integral_t), fits32 = sizeof(offset32_t) < sizeof(integral_t);
+  if (fits16) {
+    for (size_t i = 0; i < n; ++i) fits16 &= (integral_t)(offset16_t)v[i] == v[i];
+    if (fits16) return 2;
+  }
+  if (fits32) {
+    for (size_t i = 0; i < n; ++i) fits32 &= (integral_t)(offset32_t)v[i] == v[i];
+    if (fits32) return 4;
+  }
+  return sizeof(integral_t);
+}
+
+template <typename integral_t>
+void ccompressedintegral<integral_t>::setStrip(size_t ty, size_t z, const integral_t *aboveLine,
+					       const integral_t *const *lines, size_t rows)
+{
+  assert(ty < m_tiles_y && z < m_bands && rows > 0 && rows <= m_tile_size);
+
+  const size_t n = m_tile_size;
+  ctile *tiles = m_tiles + (z * m_tiles_y + ty) * m_tiles_x;
+  const size_t bytes4edge = n * sizeof(integral_t), bytes4local = n * bytes4edge;
+  uint8_t *scratch = getDefaultBufferPool().acquire(2 * bytes4edge + bytes4local);
+  integral_t *top = (integral_t *)scratch, *left = (integral_t *)(scratch + bytes4edge);
+  integral_t *local = (integral_t *)(scratch + 2 * bytes4edge);
+  uint8_t *& strip = m_strips[z * m_tiles_y + ty];
+
+  // Two passes over the tiles: the widths and the size of the strip, then
+  // the contents, so that no full-width buffer is needed.
+  for (int pass = 0; pass < 2; ++pass) {
+    size_t offset = 0;
+    for (size_t tx = 0; tx < m_tiles_x; ++tx) {
+      const size_t x0 = tx << m_tile_shift;
+      const size_t cols = std::min(n, m_width - x0);
+      const integral_t base = (x0 > 0 && aboveLine) ? aboveLine[x0 - 1] : integral_t(0);
+
+      for (size_t i = 0; i < n; ++i) top[i] = (i < cols && aboveLine) ? integral_t(aboveLine[x0 + i] - base) : integral_t(0);
+      for (size_t j = 0; j < n; ++j) left[j] = (j < rows && x0 > 0) ? integral_t(lines[j][x0 - 1] - base) : integral_t(0);
+      for (size_t j = 0; j < n; ++j) {
+	integral_t *localLine = local + j * n;
+	size_t i = 0;
+	if (j < rows) {
+	  const integral_t *intLine = lines[j] + x0;
+	  for (; i < cols; ++i) localLine[i] = intLine[i] - base - top[i] - left[j];
+	}
+	for (; i < n; ++i) localLine[i] = 0;
+      }
+
+      ctile& tile = tiles[tx];
+      if (pass == 0) {
+	tile.base = base;
+	tile.offset = offset;
+	tile.edgeBytes = (uint8_t)std::max(getOffsetBytes(top, n), getOffsetBytes(left, n));
+	tile.localBytes = (uint8_t)getOffsetBytes(local, n * n);
+      } else {
+	uint8_t *p = strip + tile.offset;
+	writeOffsets(p, top, n, tile.edgeBytes);
+	writeOffsets(p + n * tile.edgeBytes, left, n, tile.edgeBytes);
+	writeOffsets(p + 2 * n * tile.edgeBytes, local, n * n, tile.localBytes);
+      }
+      // Every part is a multiple of 8 bytes long with n >= 4
+      offset += 2 * n * tile.edgeBytes + n * n * tile.localBytes;
+    }
+
+    // Rebuilds of a similar image keep their buffers
+    if (pass == 0) {
+      if (offset > m_strip_capacity[z * m_tiles_y + ty]) {
+	delete [] strip;
+	strip = reinterpret_cast<uint8_t *>(new uint64_t[offset / 8]);
+	m_strip_capacity[z * m_tiles_y + ty] = offset;
+      }
+      m_strip_bytes[z * m_tiles_y + ty] = offset;
+    }
+  }
+
+  getDefaultBufferPool().release(scratch, 2 * bytes4edge + bytes4local);
+}
+
+template <typename integral_t>
+inline integral_t ccompressedintegral<integral_t>::getIntegral(size_t x, size_t y, size_t z) const
+{
+  assert(x < m_width && y < m_height && z < m_bands);
+
+  const size_t n = m_tile_size, tx = x >> m_tile_shift, ty = y >> m_tile_shift;
+  const size_t i = x & (n - 1), j = y & (n - 1);
+  const ctile& tile = m_tiles[(z * m_tiles_y + ty) * m_tiles_x + tx];
+  const uint8_t *p = m_strips[z * m_tiles_y + ty] + tile.offset;
+
+  integral_t v = tile.base + readOffset(p, i, tile.edgeBytes);
+  p += n * tile.edgeBytes;
+  v += readOffset(p, j, tile.edgeBytes);
+  p += n * tile.edgeBytes;
+  return v + readOffset(p, j * n + i, tile.localBytes);
+}
+
+template <typename integral_t>
+inline integral_t ccompressedintegral<integral_t>::sumBox(size_t x, size_t y, size_t w, size_t h, size_t z) const
+{
+  assert(x + w <= m_width && y + h <= m_height);
+  if (w == 0 || h == 0) return 0;
+
+  integral_t s = getIntegral(x + w - 1, y + h - 1, z);
+  if (x > 0) s -= getIntegral(x - 1, y + h - 1, z);
+  if (y > 0) {
+    s -= getIntegral(x + w - 1, y - 1, z);
+    if (x > 0) s += getIntegral(x - 1, y - 1, z);
+  }
+  return s;
+}
@@ -0,0 +1,249 @@
+/*
+  Copyright (C) 2017 Hoyoung Lee
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <algorithm>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#if defined(_OPENMP)
+# include <omp.h>
+#endif
+
+// Executors run the parallel parts of the integrators. A call splits its
+// work once into at most getConcurrency() coarse chunks, so every call
+// costs a single fork and join whatever the size of the image.
+//
+// cserialexecutor runs everything on the calling thread, copenmpexecutor
+// opens one OpenMP parallel region per call, and cthreadpool keeps its
+// threads alive between calls. Calls nested inside a task run serially.
+
+// Non-owning reference to a callable, for the tasks of the executors.
+// Unlike std::function it never allocates, which keeps the integrators
+// free of heap allocations once their buffers are pooled. The callable
+// must outlive the reference: run() and parallelFor() return only when
+// their tasks are done, so a lambda given to them may be a temporary.
+template <typename signature_t>
+class cfunctionref;
+
+template <typename R, typename... Args>
+class cfunctionref<R(Args...)> {
+public:
+  template <typename F, typename = typename std::enable_if<
+			  !std::is_same<typename std::decay<F>::type, cfunctionref>::value>::type>
+  cfunctionref(F&& f)
+    : m_object((void *)std::addressof(f)), m_call(&call<typename std::remove_reference<F>::type>) {}
+  R operator()(Args... args) const { return m_call(m_object, std::forward<Args>(args)...); }
+
+private:
+  template <typename F>
+  static R call(void *object, Args... args) { return (*(F *)object)(std::forward<Args>(args)...); }
+
+  void *m_object;
+  R (*m_call)(void *, Args...);
+};
+
+class cexecutor {
+public:
+  virtual ~cexecutor(void) {}
+  virtual size_t getConcurrency(void) const = 0;
+  // Runs task(0), ..., task(chunks-1), possibly concurrently, and returns
+  // when all of them are done.
+  virtual void run(size_t chunks, const cfunctionref<void(size_t)>& task) = 0;
+  // Splits [begin, end) into contiguous chunks whose bounds are multiples
+  // of grain from begin, and runs body(lo, hi) on every chunk.
+  void parallelFor(size_t begin, size_t end, const cfunctionref<void(size_t, size_t)>& body, size_t grain = 1);
+};
+
+inline void cexecutor::parallelFor(size_t begin, size_t end, const cfunctionref<void(size_t, size_t)>& body, size_t grain)
+{
+  if (end <= begin) return;
+  grain = std::max<size_t>(1, grain);
+  const size_t units = (end - begin + grain - 1) / grain;
+  const size_t chunks = std::min(getConcurrency(), units);
+  if (chunks <= 1) {
+    body(begin, end);
+    return;
+  }
+  run(chunks, [&](size_t c) {
+      const size_t lo = begin + (units * c / chunks) * grain;
+      const size_t hi = std::min(end, begin + (units * (c + 1) / chunks) * grain);
+      if (lo < hi) body(lo, hi);
+    });
+}
+
+class cserialexecutor : public cexecutor {
+public:
+  size_t getConcurrency(void) const { return 1; }
+  void run(size_t chunks, const cfunctionref<void(size_t)>& task)
+  {
+    for (size_t c = 0; c < chunks; ++c) task(c);
+  }
+};
+
+class copenmpexecutor : public cexecutor {
+public:
+  size_t getConcurrency(void) const
+  {
+#if defined(_OPENMP)
+    return omp_in_parallel() ? 1 : omp_get_max_threads();
+#else
+    return 1;
+#endif
+  }
+  void run(size_t chunks, const cfunctionref<void(size_t)>& task)
+  {
+#pragma omp parallel for schedule(static)
+    for (size_t c = 0; c < chunks; ++c) task(c);
+  }
+};
+
+class cthreadpool : public cexecutor {
+public:
+  // threads = 0 takes one thread per hardware thread, the caller included
+  explicit cthreadpool(size_t threads = 0);
+  virtual ~cthreadpool(void);
+  size_t getConcurrency(void) const;
+  void run(size_t chunks, const cfunctionref<void(size_t)>& task);
+
+private:
+  cthreadpool(const cthreadpool&);
+  cthreadpool& operator=(const cthreadpool&);
+  void work(void);
+  void drain(const cfunctionref<void(size_t)>& task, size_t chunks);
+  static bool& isWorker(void)
+  {
+    static thread_local bool worker = false;
+    return worker;
+  }
+
+  std::vector<std::thread> m_threads;
+  std::mutex m_run_mutex; // one run() at a time
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  std::condition_variable m_idle;
+  const cfunctionref<void(size_t)> *m_task;
+  size_t m_chunks;
+  std::atomic<size_t> m_next;
+  size_t m_pending; // chunks not finished yet, under m_mutex
+  size_t m_active; // workers inside drain(), under m_mutex
+  size_t m_generation;
+  bool m_quit;
+};
+
+inline cthreadpool::cthreadpool(size_t threads)
+  : m_task(NULL), m_chunks(0), m_next(0), m_pending(0), m_active(0), m_generation(0), m_quit(false)
+{
+  if (threads == 0) threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+  for (size_t i = 1; i < threads; ++i) m_threads.push_back(std::thread(&cthreadpool::work, this));
+}
+
+inline cthreadpool::~cthreadpool(void)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_quit = true;
+  }
+  m_wake.notify_all();
+  for (size_t i = 0; i < m_threads.size(); ++i) m_threads[i].join();
+}
+
+inline size_t cthreadpool::getConcurrency(void) const
+{
+  return isWorker() ? 1 : m_threads.size() + 1;
+}
+
+inline void cthreadpool::run(size_t chunks, const cfunctionref<void(size_t)>& task)
+{
+  if (chunks == 0) return;
+  if (isWorker() || m_threads.empty() || chunks == 1) {
+    for (size_t c = 0; c < chunks; ++c) task(c);
+    return;
+  }
+
+  std::lock_guard<std::mutex> runLock(m_run_mutex);
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_task = &task;
+    m_chunks = chunks;
+    m_next.store(0, std::memory_order_relaxed);
+    m_pending = chunks;
+    ++m_generation;
+  }
+  m_wake.notify_all();
+
+  // The caller takes chunks as well, then waits for the stragglers
+  isWorker() = true;
+  drain(task, chunks);
+  isWorker() = false;
+
+  // No worker may still hold the task when the next run() starts
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_idle.wait(lock, [this] { return m_pending == 0 && m_active == 0; });
+  m_task = NULL;
+}
+
+inline void cthreadpool::drain(const cfunctionref<void(size_t)>& task, size_t chunks)
+{
+  size_t done = 0;
+  for (size_t c = m_next++; c < chunks; c = m_next++, ++done) task(c);
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_pending -= done;
+  if (m_pending == 0) m_idle.notify_one();
+}
+
+inline void cthreadpool::work(void)
+{
+  isWorker() = true;
+  size_t generation = 0;
+  for (;;) {
+    const cfunctionref<void(size_t)> *task;
+    size_t chunks;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_wake.wait(lock, [&] { return m_quit || (m_generation != generation && m_task != NULL); });
+      if (m_quit) return;
+      generation = m_generation;
+      task = m_task;
+      chunks = m_chunks;
+      ++m_active;
+    }
+    drain(*task, chunks);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (--m_active == 0 && m_pending == 0) m_idle.notify_one();
+  }
+}
+
+// Executor used when none is given: OpenMP when it is enabled, serial
+// otherwise.
+inline cexecutor& getDefaultExecutor(void)
+{
+#if defined(_OPENMP)
+  static copenmpexecutor executor;
+#else
+  static cserialexecutor executor;
+#endif
+  return executor;
+}
@@ -23,37 +23,106 @@
 //#include <cmemory>
 #include <cassert>
 #include <cstdint>
+#include <algorithm>
+#include <atomic>
 
 #include "cregion.hpp"
+#include "cbufferpool.hpp"
+#include "power_of_2.hpp"
 
 #define QWORD_ALIGN(bytes) (((bytes) + 7) & -8)
+#define ALIGN_BYTES(bytes) (((bytes) + 63) & -64) // cache line alignment
+
+// Every buffer and every row starts on a cache line, so that no vector
+// load straddles two lines. The allocation flags of a pixmap apply to its
+// next setResolution():
+//   ZERO_FILL   clears the pixels, for images which are not written in
+//               full before they are read (the default)
+//   HUGE_PAGES  aligns buffers of 2 MB or more on 2 MB and asks Linux to
+//               back them with transparent huge pages
+//   POOLED      takes the buffer from getDefaultBufferPool() and gives it
+//               back there on destruction
+//   SHARED      makes copies share the buffer, with a reference count,
+//               until one of them is written
+//   PAD_STRIDE  adds a cache line to row strides on a multiple of 512
+//               bytes, for widths such as 1024 or 4096 whose rows would
+//               all fall in the same few L1 sets when walking a column
+// An integral which is written in full right after its allocation takes
+// no flags: its pages are then touched once, by the integrator threads.
+//
+// As with std::vector, a pixmap keeps its buffer while the new resolution
+// fits in it, so setResolution() to the same or a smaller size allocates
+// nothing, unless HUGE_PAGES, POOLED or SHARED changed since the buffer was
+// allocated.
+//
+// Copies hold the same pixels: a copy of a SHARED pixmap takes a
+// reference on its buffer, and other copies copy the pixels. The writing
+// methods of a shared pixmap, and the integrators on their integrals,
+// first detach() it onto a buffer of its own. getLine(), getImage() and
+// getPixel() hand out raw pointers and do not detach: call detach() before
+// writing through them. Moves take the buffer and leave an empty pixmap.
+//
+// A view is a pixmap over pixels it does not own: a buffer of the caller,
+// with any row and band strides, or a region of another pixmap from
+// getView(). Views go wherever pixmaps go, integrators included, and
+// their pixels must outlive them and stay in place: a view of a pixmap is
+// lost when the pixmap reallocates or detaches. Moves keep the view,
+// copies copy its pixels into a pixmap of their own, and setResolution()
+// gives it a buffer of its own.
 
 template <typename T>
 class cpixmap : public cregion<size_t> {
   //
 public:
+  enum ALLOCATION_FLAGS {
+    ZERO_FILL = 1,
+    HUGE_PAGES = 2,
+    POOLED = 4,
+    SHARED = 8,
+    PAD_STRIDE = 16
+  };
+
   cpixmap(void);
-  cpixmap(size_t w, size_t h, size_t b = 1);
+  cpixmap(size_t w, size_t h, size_t b = 1, int allocation = ZERO_FILL);
   cpixmap(const cpixmap& pixmap);
+  cpixmap(cpixmap&& pixmap) noexcept;
   cpixmap(const cregion& dim);
+  // View over w x h x b pixels at data, lineStride bytes between rows and
+  // bandStride bytes between bands (h * lineStride when 0)
+  cpixmap(T *data, size_t w, size_t h, size_t b, size_t lineStride, size_t bandStride = 0);
+  cpixmap& operator=(const cpixmap& pixmap);
+  cpixmap& operator=(cpixmap&& pixmap) noexcept;
   virtual ~cpixmap(void);
   T *getImage(size_t z = 0) const;
   T *getLine(size_t y, size_t z = 0) const;
   T& getPixel(size_t x, size_t y, size_t z = 0) const;
   void putPixel(T val, size_t x, size_t y, size_t z = 0);
   void setResolution(size_t w, size_t h, size_t b = 1);
+  int getAllocation(void) const { return m_allocation; }
+  void setAllocation(int allocation) { m_allocation = allocation; }
+  // Bytes between two rows, and taken by the pixels of all the bands
+  size_t getLineStride(void) const { return m_height_stride; }
+  size_t getBytes(void) const { return m_bands * m_band_stride; }
+  size_t getCapacity(void) const { return m_capacity; }
+  // True while other pixmaps hold the same buffer
+  bool isShared(void) const { return m_refs && m_refs->load(std::memory_order_acquire) > 1; }
+  void detach(void);
+  bool isView(void) const { return m_view; }
+  // View over the pixels of roi, whose origin is in this pixmap
+  cpixmap getView(const cregion& roi);
   bool isMatched(const cpixmap& pixmap) const;
   bool isMatched(const cregion& a) const;
   bool isMatched(size_t w, size_t h, size_t b = 1) const;
   void readVLine(T *line, size_t len, size_t x, size_t y, size_t z = 0) const;
   void readHLine(T *line, size_t len, size_t x, size_t y, size_t z = 0) const;
+  void writeVLine(const T *line, size_t len, size_t x, size_t y, size_t z = 0);
+  void writeHLine(const T *line, size_t len, size_t x, size_t y, size_t z = 0);
   void flipHorizontally(void);
   void flipVertically(void);
   void lshiftPixel(size_t bits = 1);
   void rshiftPixel(size_t bits = 1);
-  //  cpixmap<T> operator=(const cpixmap<T>& m);
-  T& operator() (size_t z, size_t y, size_t x) { return *(T *)(m_buffer + z*m_band_stride + y*m_height_stride + x*sizeof(T)); }
-  T& operator() (size_t y, size_t x) { return *(T *)(m_buffer + y*m_height_stride + x*sizeof(T)); }
+  T& operator() (size_t z, size_t y, size_t x) { detach(); return *(T *)(m_buffer + z*m_band_stride + y*m_height_stride + x*sizeof(T)); }
+  T& operator() (size_t y, size_t x) { detach(); return *(T *)(m_buffer + y*m_height_stride + x*sizeof(T)); }
 
   enum RGB_COLOR {
     BLUE_BAND = 0,
@@ -65,18 +134,74 @@ public:
 private:
   //void reallocate(size_t w, size_t h);
   void reallocate(size_t w, size_t h, size_t b = 0);
+  size_t setStrides(size_t w, size_t h, size_t b);
+  bool isReusable(size_t bytes) const;
+  void allocate(size_t bytes);
+  void release(void);
+  void copy(const cpixmap& pixmap);
+  void steal(cpixmap& pixmap);
+  void copyPixels(const cpixmap& pixmap);
   size_t m_height_stride;
   size_t m_band_stride;
   uint8_t *m_buffer;
+  size_t m_capacity;
+  int m_allocation;
+  int m_buffer_allocation;  // flags the buffer was allocated with
+  std::atomic<size_t> *m_refs;  // pixmaps holding a SHARED buffer
+  bool m_view;  // the buffer belongs to someone else
 };
 
+template <typename T>
+void cpixmap<T>::allocate(size_t bytes)
+{
+  const bool hugePages = (m_allocation & HUGE_PAGES) != 0;
+  if (m_allocation & POOLED) {
+    m_buffer = getDefaultBufferPool().acquire(bytes, hugePages);
+    m_capacity = cbufferpool::getCapacity(bytes);
+  } else {
+    m_buffer = allocateBuffer(bytes, hugePages);
+    m_capacity = bytes;
+  }
+  m_buffer_allocation = m_allocation;
+  m_refs = (m_allocation & SHARED) ? new std::atomic<size_t>(1) : NULL;
+  m_view = false;
+}
+
+template <typename T>
+void cpixmap<T>::release(void)
+{
+  if (!m_buffer) return;
+  if (m_view) {
+    m_buffer = NULL;
+    m_view = false;
+    return;
+  }
+  // The last pixmap holding a shared buffer frees it
+  if (m_refs && m_refs->fetch_sub(1, std::memory_order_acq_rel) > 1) {
+    m_buffer = NULL;
+    m_capacity = 0;
+    m_refs = NULL;
+    return;
+  }
+  delete m_refs;
+  m_refs = NULL;
+  if (m_buffer_allocation & POOLED)
+    getDefaultBufferPool().release(m_buffer, m_capacity, (m_buffer_allocation & HUGE_PAGES) != 0);
+  else
+    releaseBuffer(m_buffer);
+  m_buffer = NULL;
+  m_capacity = 0;
+}
+
 template <typename T> 
 cpixmap<T>::cpixmap(void)
-  : m_height_stride(0), m_band_stride(0), m_buffer(NULL) {}
+  : m_height_stride(0), m_band_stride(0), m_buffer(NULL), m_capacity(0), m_allocation(ZERO_FILL),
+    m_buffer_allocation(0), m_refs(NULL), m_view(false) {}
 
 template <typename T>
-cpixmap<T>::cpixmap(size_t w, size_t h, size_t b)
-  : cregion(w, h, b), m_height_stride(0), m_band_stride(0), m_buffer(NULL)
+cpixmap<T>::cpixmap(size_t w, size_t h, size_t b, int allocation)
+  : cregion(w, h, b), m_height_stride(0), m_band_stride(0), m_buffer(NULL), m_capacity(0),
+    m_allocation(allocation), m_buffer_allocation(0), m_refs(NULL), m_view(false)
 {
   //setResolution(w, h, b);
   reallocate(w, h, b);
@@ -84,26 +209,151 @@ cpixmap<T>::cpixmap(size_t w, size_t h, size_t b)
 
 template <typename T>
 cpixmap<T>::cpixmap(const cpixmap& pixmap)
-  : m_height_stride(0), m_band_stride(0), m_buffer(NULL)
+  : m_height_stride(0), m_band_stride(0), m_buffer(NULL), m_capacity(0), m_allocation(pixmap.m_allocation),
+    m_buffer_allocation(0), m_refs(NULL), m_view(false)
 {
-  const cregion dim = static_cast<const cregion>(pixmap);
-  setResolution(dim.getWidth(), dim.getHeight(), dim.getBands());
+  copy(pixmap);
+}
+
+template <typename T>
+cpixmap<T>::cpixmap(cpixmap&& pixmap) noexcept
+  : m_height_stride(0), m_band_stride(0), m_buffer(NULL), m_capacity(0), m_allocation(pixmap.m_allocation),
+    m_buffer_allocation(0), m_refs(NULL), m_view(false)
+{
+  steal(pixmap);
 }
   
 template <typename T>
 cpixmap<T>::cpixmap(const cregion& dim)
-  : m_height_stride(0), m_band_stride(0), m_buffer(NULL)
+  : m_height_stride(0), m_band_stride(0), m_buffer(NULL), m_capacity(0), m_allocation(ZERO_FILL),
+    m_buffer_allocation(0), m_refs(NULL), m_view(false)
 {
   setResolution(dim.getWidth(), dim.getHeight(), dim.getBands());
 }
 
+template <typename T>
+cpixmap<T>::cpixmap(T *data, size_t w, size_t h, size_t b, size_t lineStride, size_t bandStride)
+  : cregion(w, h, b), m_height_stride(lineStride), m_band_stride(bandStride ? bandStride : h * lineStride),
+    m_buffer(reinterpret_cast<uint8_t *>(data)), m_capacity(0), m_allocation(ZERO_FILL),
+    m_buffer_allocation(0), m_refs(NULL), m_view(true)
+{
+  assert(data || w * h * b == 0);
+  assert(lineStride % sizeof(T) == 0 && m_band_stride % sizeof(T) == 0);
+  assert(h <= 1 || lineStride >= w * sizeof(T));
+  assert(b <= 1 || m_band_stride >= (h - 1) * lineStride + w * sizeof(T));
+}
+
+template <typename T>
+cpixmap<T> cpixmap<T>::getView(const cregion& roi)
+{
+  assert(roi.getXEnd() <= m_width && roi.getYEnd() <= m_height && roi.getZEnd() <= m_bands);
+
+  // Writes through the view must not reach the other holders
+  detach();
+  return cpixmap(getLine(roi.getYOrigin(), roi.getZOrigin()) + roi.getXOrigin(),
+		 roi.getWidth(), roi.getHeight(), roi.getBands(), m_height_stride, m_band_stride);
+}
+
 template <typename T>
 cpixmap<T>::~cpixmap(void)
 {
   //std::cout << static_cast<void *>(this) << " paraent" <<std::endl;
   //std::cout << static_cast<void *>(m_buffer) << " is freed!" << std::endl;
-  if (m_buffer) delete [] reinterpret_cast<double *>(m_buffer);
-  m_buffer = NULL;
+  release();
+}
+
+// The destination keeps its allocation flags, and its buffer when the
+// pixels fit in it, but for the copy of a SHARED pixmap which shares and
+// the copy of an empty pixmap which leaves no buffer.
+template <typename T>
+cpixmap<T>& cpixmap<T>::operator=(const cpixmap& pixmap)
+{
+  if (this == &pixmap) return *this;
+  // setStrides() comes last: the strides are set again by copy()
+  if (pixmap.m_refs || !pixmap.m_buffer || !isReusable(setStrides(pixmap.m_width, pixmap.m_height, pixmap.m_bands))) {
+    release();
+    copy(pixmap);
+  } else {
+    cregion::operator=(pixmap);
+    copyPixels(pixmap);
+  }
+  return *this;
+}
+
+template <typename T>
+cpixmap<T>& cpixmap<T>::operator=(cpixmap&& pixmap) noexcept
+{
+  if (this == &pixmap) return *this;
+  release();
+  steal(pixmap);
+  return *this;
+}
+
+// Takes the region and the pixels of pixmap into an empty pixmap
+template <typename T>
+void cpixmap<T>::copy(const cpixmap& pixmap)
+{
+  cregion::operator=(pixmap);
+  if (pixmap.m_refs) {
+    pixmap.m_refs->fetch_add(1, std::memory_order_relaxed);
+    m_height_stride = pixmap.m_height_stride;
+    m_band_stride = pixmap.m_band_stride;
+    m_buffer = pixmap.m_buffer;
+    m_capacity = pixmap.m_capacity;
+    m_buffer_allocation = pixmap.m_buffer_allocation;
+    m_refs = pixmap.m_refs;
+  } else if (pixmap.m_buffer) {
+    allocate(setStrides(m_width, m_height, m_bands));
+    copyPixels(pixmap);
+  }
+}
+
+// Pixels of a pixmap of the same resolution, row by row when either side
+// has strides of its own
+template <typename T>
+void cpixmap<T>::copyPixels(const cpixmap& pixmap)
+{
+  if (!m_view && !pixmap.m_view && m_height_stride == pixmap.m_height_stride) {
+    std::memcpy(m_buffer, pixmap.m_buffer, getBytes());
+    return;
+  }
+  for (size_t z = 0; z < m_bands; ++z) {
+    for (size_t y = 0; y < m_height; ++y) std::memcpy(getLine(y, z), pixmap.getLine(y, z), m_width * sizeof(T));
+  }
+}
+
+// Takes the region and the buffer of pixmap into an empty pixmap, and
+// leaves pixmap empty with its allocation flags
+template <typename T>
+void cpixmap<T>::steal(cpixmap& pixmap)
+{
+  cregion::operator=(pixmap);
+  m_height_stride = pixmap.m_height_stride;
+  m_band_stride = pixmap.m_band_stride;
+  m_buffer = pixmap.m_buffer;
+  m_capacity = pixmap.m_capacity;
+  m_buffer_allocation = pixmap.m_buffer_allocation;
+  m_refs = pixmap.m_refs;
+  m_view = pixmap.m_view;
+  pixmap.cregion::setResolution(0, 0, 0);
+  pixmap.m_height_stride = pixmap.m_band_stride = 0;
+  pixmap.m_buffer = NULL;
+  pixmap.m_capacity = 0;
+  pixmap.m_refs = NULL;
+  pixmap.m_view = false;
+}
+
+template <typename T>
+void cpixmap<T>::detach(void)
+{
+  if (!isShared()) return;
+  // shared holds the reference until the pixels are copied
+  cpixmap shared(std::move(*this));
+  cregion::operator=(shared);
+  m_height_stride = shared.m_height_stride;
+  m_band_stride = shared.m_band_stride;
+  allocate(shared.getBytes());
+  std::memcpy(m_buffer, shared.m_buffer, shared.getBytes());
 }
 
 template <typename T>
@@ -113,20 +363,45 @@ void cpixmap<T>::setResolution(size_t w, size_t h, size_t b)
   reallocate(w, h, b);
 }
 
+// Strides of a buffer of w x h x b pixels, and its size
 template <typename T>
-void cpixmap<T>::reallocate(size_t w, size_t h, size_t b)
+size_t cpixmap<T>::setStrides(size_t w, size_t h, size_t b)
 {
-  size_t bytes;
-
-  m_height_stride = QWORD_ALIGN(w * sizeof(T)); //+ 7) & -8; // 8 bytes alignment
+  // All the strides are in size_t: a band may take more than 4 GB
+  assert(w <= (SIZE_MAX - 127) / sizeof(T));
+  m_height_stride = ALIGN_BYTES(w * sizeof(T)); // cache line alignment
+  // A 32 KB, 8-way L1 indexes its 64 sets with bits 6..11 of an address:
+  // rows 512 * 2^k bytes apart share 8 / 2^k of them, one more line apart
+  // go through all of them.
+  if ((m_allocation & PAD_STRIDE) && m_height_stride > 0 && countTrailingZeros(m_height_stride) >= 9)
+    m_height_stride += 64;
+  assert(h == 0 || m_height_stride <= SIZE_MAX / h);
   m_band_stride = h * m_height_stride;
-  
-  bytes = b * m_band_stride;
+  assert(b == 0 || m_band_stride <= (SIZE_MAX - HUGE_PAGE_BYTES) / b);
+  return b * m_band_stride;
+}
 
-  if (m_buffer) delete (double *)m_buffer;
-  m_buffer = reinterpret_cast<uint8_t *>(new double[(bytes + 7) / 8]);
-  assert(m_buffer);
-  memset(m_buffer, 0, bytes);
+// True when the buffer may take bytes with the current allocation flags.
+// A shared buffer stays with the other pixmaps, and a view's with its
+// owner. ZERO_FILL and PAD_STRIDE act on the next pixels and strides, but
+// the other flags were applied by allocate() and need a new buffer.
+template <typename T>
+bool cpixmap<T>::isReusable(size_t bytes) const
+{
+  return m_buffer && !m_view && !isShared() && bytes <= m_capacity &&
+    !((m_allocation ^ m_buffer_allocation) & (HUGE_PAGES | POOLED | SHARED));
+}
+
+template <typename T>
+void cpixmap<T>::reallocate(size_t w, size_t h, size_t b)
+{
+  const size_t bytes = setStrides(w, h, b);
+
+  if (!isReusable(bytes)) {
+    release();
+    allocate(bytes);
+  }
+  if (m_allocation & ZERO_FILL) memset(m_buffer, 0, bytes);
   //std::cout << static_cast<void *>(this) << " paraent" <<std::endl;
   //std::cout << bytes << " bytes are allocated at " << static_cast<void *>(m_buffer) << std::endl;
 }
@@ -171,6 +446,7 @@ inline T& cpixmap<T>::getPixel(size_t x, size_t y, size_t z) const
 template <typename T>
 inline void cpixmap<T>::putPixel(T val, size_t x, size_t y, size_t z)
 {
+  detach();
   *(T *)(m_buffer + z*m_band_stride + y*m_height_stride + x*sizeof(T)) = val;
 }
 
@@ -202,18 +478,37 @@ void cpixmap<T>::readHLine(T *line, size_t len, size_t x, size_t y, size_t z) co
   }
 }
 
-/*
 template <typename T>
-cpixmap<T> cpixmap<T>::operator=(const cpixmap<T>& m)
+void cpixmap<T>::writeVLine(const T *line, size_t len, size_t x, size_t y, size_t z)
 {
-  assert(isMatched((cregion)m));
-  
+  detach();
+  uint8_t *p;
+
+  assert(cregion::include(x, y, z));
+
+  p = m_buffer + z*m_band_stride + y*m_height_stride + x*sizeof(T);
+  for (size_t i = 0; i < std::min(len, m_height-y); ++i) {
+    *(T *)p = *(line + i);
+    p += m_height_stride;
+  }
+}
+
+template <typename T>
+void cpixmap<T>::writeHLine(const T *line, size_t len, size_t x, size_t y, size_t z)
+{
+  detach();
+  uint8_t *p;
+
+  assert(cregion::include(x, y, z));
+
+  p = m_buffer + z*m_band_stride + y*m_height_stride + x*sizeof(T);
+  std::memcpy(p, line, std::min(len, m_width-x) * sizeof(T));
 }
-*/
 
 template <typename T>
 void cpixmap<T>::flipHorizontally(void)
 {
+  detach();
   for (size_t z = 0; z < m_bands; ++z) {
 #pragma omp parallel for
     for (size_t y = 0; y < m_height; ++y) {
@@ -230,12 +525,13 @@ void cpixmap<T>::flipHorizontally(void)
 template <typename T>
 void cpixmap<T>::flipVertically(void)
 {
+  detach();
   for (size_t z = 0; z < m_bands; ++z) {
 #pragma omp parallel for
     for (size_t x = 0; x < m_width; ++x) {
       uint8_t *p = m_buffer + z*m_band_stride + x*sizeof(T);
       for (size_t y = 0; y < (m_height>>1); ++y) {
-	T temp = *((T *)p + y*m_height_stride);
+	T temp = *(T *)(p + y*m_height_stride);
 	*(T *)(p + y*m_height_stride) = *(T *)(p + ((m_height-1) - y)*m_height_stride);
 	*(T *)(p + ((m_height-1)-y)*m_height_stride) = temp;
       }
@@ -246,6 +542,7 @@ void cpixmap<T>::flipVertically(void)
 template <typename T>
 void cpixmap<T>::lshiftPixel(size_t bits)
 {
+  detach();
   for (size_t z = 0; z < m_bands; ++z) {
 #pragma omp parallel for
     for (size_t y = 0; y < m_height; ++y) {
@@ -258,6 +555,7 @@ void cpixmap<T>::lshiftPixel(size_t bits)
 template <typename T>
 void cpixmap<T>::rshiftPixel(size_t bits)
 {
+  detach();
   for (size_t z = 0; z < m_bands; ++z) {
 #pragma omp parallel for
     for (size_t y = 0; y < m_height; ++y) {
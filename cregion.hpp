@@ -16,6 +16,8 @@
 */
 #pragma once
 
+#include <cstddef>
+
 template <typename T>
 class cpoint {
 public:
@@ -136,10 +138,10 @@ public:
   bool include(const T x, const T y, const T z = 0) const;
   bool include(const cpoint<T>& pt) const;
   virtual bool isMatched(const cregion& dim) const;
-  int getLeftHalf(void) const;
-  int getRightHalf(void) const;
-  int getUpHalf(void) const;
-  int getDownHalf(void) const;
+  std::ptrdiff_t getLeftHalf(void) const;
+  std::ptrdiff_t getRightHalf(void) const;
+  std::ptrdiff_t getUpHalf(void) const;
+  std::ptrdiff_t getDownHalf(void) const;
 protected:
   T m_x, m_y, m_z;  
   T m_width, m_height; // x x y
@@ -200,25 +202,25 @@ template <typename T>
 inline T cregion<T>::getZEnd(void) const { return m_z + m_bands; }
 
 template <typename T>
-inline int cregion<T>::getLeftHalf(void) const
+inline std::ptrdiff_t cregion<T>::getLeftHalf(void) const
 {
-  return (m_width>>1) + 1 - m_width; // negative value
+  return (std::ptrdiff_t)(m_width>>1) + 1 - (std::ptrdiff_t)m_width; // negative value
 }
 
 template <typename T>
-inline int cregion<T>::getRightHalf(void) const
+inline std::ptrdiff_t cregion<T>::getRightHalf(void) const
 {
-  return (m_width>>1) + 1; // positive value
+  return (std::ptrdiff_t)(m_width>>1) + 1; // positive value
 }
 
 template <typename T>
-inline int cregion<T>::getUpHalf(void) const
+inline std::ptrdiff_t cregion<T>::getUpHalf(void) const
 {
-  return (m_height>>1) + 1 - m_height; // negative value
+  return (std::ptrdiff_t)(m_height>>1) + 1 - (std::ptrdiff_t)m_height; // negative value
 }
 
 template <typename T>
-inline int cregion<T>::getDownHalf(void) const
+inline std::ptrdiff_t cregion<T>::getDownHalf(void) const
 {
-  return (m_height>>1) + 1;
+  return (std::ptrdiff_t)(m_height>>1) + 1;
 }
@@ -0,0 +1,223 @@
+/*
+  Copyright (C) 2017 Hoyoung Lee
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+
+#include "cregion.hpp"
+#include "cpixmap.hpp"
+
+#define SPARSE_EMPTY_TILE (~(size_t)0) // offset of a tile without local SAT
+
+// Summed-area table of a sparse image, stored tile by tile.
+//
+// The image is cut into tiles of tileSize x tileSize and, for the tile at
+// (x0, y0),
+//
+//   I(x, y) = above(x) + left(y) + local(x, y)
+//
+// where above(x) = I(x, y0-1) is the integral row above the tile row,
+// left(y) the sum of the rows y0..y of the tile row left of x0, and
+// local(x, y) the SAT of the pixels of the tile alone. Only the tiles
+// holding a non-zero pixel keep a local SAT; the others are all zeros and
+// their integrals come from above() and left() alone. above() and left()
+// cost 2 / tileSize integrals per pixel, and every occupied tile one
+// integral per pixel.
+
+template <typename integral_t>
+class csparseintegral : public cregion<size_t> {
+public:
+  csparseintegral(void);
+  csparseintegral(size_t w, size_t h, size_t b = 1, size_t tileSize = 32);
+  virtual ~csparseintegral(void);
+  void setResolution(size_t w, size_t h, size_t b = 1);
+  void setResolution(size_t w, size_t h, size_t b, size_t tileSize);
+  size_t getTileSize(void) const { return m_tile_size; }
+  size_t getTilesX(void) const { return m_tiles_x; }
+  size_t getTilesY(void) const { return m_tiles_y; }
+  size_t getOccupiedTiles(void) const;
+  size_t getBytes(void) const;
+  // above() row of tile row ty and left() of row y
+  integral_t *getAboveLine(size_t ty, size_t z = 0) const { return m_above.getLine(ty, z); }
+  integral_t *getLeftLine(size_t y, size_t z = 0) const { return m_left.getLine(y, z); }
+  // Local SAT of a tile, tileSize integrals per row, or NULL if it is empty
+  integral_t *getTile(size_t tx, size_t ty, size_t z = 0) const;
+  // Gives local SATs to the tiles of tile row ty of band z whose flag is
+  // set in occupied[0..tilesX), and drops those of the others.
+  void setOccupancy(size_t ty, size_t z, const bool *occupied);
+  // I(x, y), the sum of the pixels in [0, x] x [0, y]
+  integral_t getIntegral(size_t x, size_t y, size_t z = 0) const;
+  // Sum of the pixels of the w x h box at (x, y)
+  integral_t sumBox(size_t x, size_t y, size_t w, size_t h, size_t z = 0) const;
+
+private:
+  csparseintegral(const csparseintegral&);
+  csparseintegral& operator=(const csparseintegral&);
+
+  void release(void);
+
+  size_t m_tile_size;
+  size_t m_tile_shift;
+  size_t m_tiles_x;
+  size_t m_tiles_y;
+  cpixmap<integral_t> m_above;  // w x tilesY
+  cpixmap<integral_t> m_left;   // tilesX x h
+  size_t *m_offsets;            // [z][ty][tx], in integrals into the strip
+  integral_t **m_strips;        // [z][ty]
+  size_t *m_strip_tiles;        // [z][ty]
+  size_t *m_strip_capacity;     // [z][ty], in tiles
+};
+
+template <typename integral_t>
+csparseintegral<integral_t>::csparseintegral(void)
+  : m_tile_size(32), m_tile_shift(5), m_tiles_x(0), m_tiles_y(0),
+    m_offsets(NULL), m_strips(NULL), m_strip_tiles(NULL), m_strip_capacity(NULL)
+{
+}
+
+template <typename integral_t>
+csparseintegral<integral_t>::csparseintegral(size_t w, size_t h, size_t b, size_t tileSize)
+  : m_tile_size(32), m_tile_shift(5), m_tiles_x(0), m_tiles_y(0),
+    m_offsets(NULL), m_strips(NULL), m_strip_tiles(NULL), m_strip_capacity(NULL)
+{
+  setResolution(w, h, b, tileSize);
+}
+
+template <typename integral_t>
+csparseintegral<integral_t>::~csparseintegral(void)
+{
+  release();
+}
+
+template <typename integral_t>
+void csparseintegral<integral_t>::release(void)
+{
+  if (m_strips) {
+    for (size_t s = 0; s < m_bands * m_tiles_y; ++s) delete [] m_strips[s];
+    delete [] m_strips;
+  }
+  if (m_offsets) delete [] m_offsets;
+  if (m_strip_tiles) delete [] m_strip_tiles;
+  if (m_strip_capacity) delete [] m_strip_capacity;
+  m_strips = NULL;
+  m_offsets = NULL;
+  m_strip_tiles = NULL;
+  m_strip_capacity = NULL;
+}
+
+template <typename integral_t>
+void csparseintegral<integral_t>::setResolution(size_t w, size_t h, size_t b)
+{
+  setResolution(w, h, b, m_tile_size);
+}
+
+template <typename integral_t>
+void csparseintegral<integral_t>::setResolution(size_t w, size_t h, size_t b, size_t tileSize)
+{
+  assert(tileSize >= 4 && (tileSize & (tileSize - 1)) == 0);
+
+  release();
+  cregion::setResolution(w, h, b);
+  m_tile_size = tileSize;
+  for (m_tile_shift = 0; ((size_t)1 << m_tile_shift) < tileSize; ++m_tile_shift);
+  m_tiles_x = (w + tileSize - 1) >> m_tile_shift;
+  m_tiles_y = (h + tileSize - 1) >> m_tile_shift;
+
+  m_above.setResolution(w, m_tiles_y, b);
+  m_left.setResolution(m_tiles_x, h, b);
+  m_offsets = new size_t[b * m_tiles_y * m_tiles_x];
+  for (size_t t = 0; t < b * m_tiles_y * m_tiles_x; ++t) m_offsets[t] = SPARSE_EMPTY_TILE;
+  m_strips = new integral_t*[b * m_tiles_y];
+  m_strip_tiles = new size_t[b * m_tiles_y];
+  m_strip_capacity = new size_t[b * m_tiles_y];
+  for (size_t s = 0; s < b * m_tiles_y; ++s) {
+    m_strips[s] = NULL;
+    m_strip_tiles[s] = 0;
+    m_strip_capacity[s] = 0;
+  }
+}
+
+template <typename integral_t>
+size_t csparseintegral<integral_t>::getOccupiedTiles(void) const
+{
+  size_t tiles = 0;
+  for (size_t s = 0; s < m_bands * m_tiles_y; ++s) tiles += m_strip_tiles[s];
+  return tiles;
+}
+
+template <typename integral_t>
+size_t csparseintegral<integral_t>::getBytes(void) const
+{
+  size_t tiles = 0;
+  for (size_t s = 0; s < m_bands * m_tiles_y; ++s) tiles += m_strip_capacity[s];
+  return tiles * m_tile_size * m_tile_size * sizeof(integral_t) + m_above.getBytes() + m_left.getBytes() +
+    m_bands * (m_tiles_y * m_tiles_x * sizeof(size_t) + m_tiles_y * 2 * sizeof(size_t));
+}
+
+template <typename integral_t>
+void csparseintegral<integral_t>::setOccupancy(size_t ty, size_t z, const bool *occupied)
+{
+  assert(ty < m_tiles_y && z < m_bands);
+
+  const size_t s = z * m_tiles_y + ty, area = m_tile_size * m_tile_size;
+  size_t *offsets = m_offsets + s * m_tiles_x;
+  size_t tiles = 0;
+  for (size_t tx = 0; tx < m_tiles_x; ++tx) offsets[tx] = occupied[tx] ? (tiles++) * area : SPARSE_EMPTY_TILE;
+
+  // Rebuilds of a similar image keep their buffers
+  if (tiles > m_strip_capacity[s]) {
+    delete [] m_strips[s];
+    m_strips[s] = new integral_t[tiles * area];
+    m_strip_capacity[s] = tiles;
+  }
+  m_strip_tiles[s] = tiles;
+}
+
+template <typename integral_t>
+inline integral_t *csparseintegral<integral_t>::getTile(size_t tx, size_t ty, size_t z) const
+{
+  const size_t s = z * m_tiles_y + ty, offset = m_offsets[s * m_tiles_x + tx];
+  return (offset == SPARSE_EMPTY_TILE) ? NULL : m_strips[s] + offset;
+}
+
+template <typename integral_t>
+inline integral_t csparseintegral<integral_t>::getIntegral(size_t x, size_t y, size_t z) const
+{
+  assert(x < m_width && y < m_height && z < m_bands);
+
+  const size_t tx = x >> m_tile_shift, ty = y >> m_tile_shift;
+  integral_t v = m_above.getLine(ty, z)[x] + m_left.getLine(y, z)[tx];
+  const integral_t *tile = getTile(tx, ty, z);
+  if (tile) v += tile[((y & (m_tile_size - 1)) << m_tile_shift) + (x & (m_tile_size - 1))];
+  return v;
+}
+
+template <typename integral_t>
+inline integral_t csparseintegral<integral_t>::sumBox(size_t x, size_t y, size_t w, size_t h, size_t z) const
+{
+  assert(x + w <= m_width && y + h <= m_height);
+  if (w == 0 || h == 0) return 0;
+
+  integral_t s = getIntegral(x + w - 1, y + h - 1, z);
+  if (x > 0) s -= getIntegral(x - 1, y + h - 1, z);
+  if (y > 0) {
+    s -= getIntegral(x + w - 1, y - 1, z);
+    if (x > 0) s += getIntegral(x - 1, y - 1, z);
+  }
+  return s;
+}
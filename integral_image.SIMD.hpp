@@ -0,0 +1,691 @@
+/*
+  Copyright (C) 2017 Hoyoung Lee
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <type_traits>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# if !defined(MAX_VECTOR_SIZE)
+#  define MAX_VECTOR_SIZE 512
+# endif
+# include <vectorclass/vectorclass.h>
+# if INSTRSET < 2
+#  error "Unsupported x86-SIMD! Please comment USE_SIMD on!"
+# endif
+#else
+# error "Undefined SIMD!"
+#endif
+
+template <typename pixel_t, typename integral_t>
+inline void integrateLineScalar(const pixel_t *pixLine, const integral_t *prevLine, integral_t *intLine, size_t width);
+
+// integral_image.dispatch.cpp compiles these kernels once per instruction
+// set, each copy in its own namespace.
+#if defined(INTEGRAL_SIMD_NAMESPACE)
+namespace INTEGRAL_SIMD_NAMESPACE {
+#endif
+#if defined(VCL_NAMESPACE)
+using namespace VCL_NAMESPACE;
+#endif
+
+// One row of the integral image is made by an in-register prefix scan:
+// the widened pixels are scanned with log2(N) shift-and-add steps, the
+// running row sum is carried between vectors as a broadcast of the last
+// element, and the previous integral row is added with a plain vertical add.
+// Integer lanes are kept unsigned; signed pixels are sign-extended on load
+// and the two's complement additions give the same bits.
+
+#if INSTRSET >= 9 // AVX512 - 512bits
+typedef Vec16us integral_vec16_t; // 512-bit words need AVX512BW
+typedef Vec16ui integral_vec32_t;
+typedef Vec8uq integral_vec64_t;
+typedef Vec16f integral_vecf_t;
+typedef Vec8d integral_vecd_t;
+#elif INSTRSET >= 8 // AVX2 - 256bits
+typedef Vec16us integral_vec16_t;
+typedef Vec8ui integral_vec32_t;
+typedef Vec4uq integral_vec64_t;
+typedef Vec8f integral_vecf_t;
+typedef Vec4d integral_vecd_t;
+#else // SSE2 - 128bits
+typedef Vec8us integral_vec16_t;
+typedef Vec4ui integral_vec32_t;
+typedef Vec2uq integral_vec64_t;
+typedef Vec4f integral_vecf_t;
+typedef Vec2d integral_vecd_t;
+#endif
+
+template <typename T>
+inline T loadUnaligned(const void *p)
+{
+  T v;
+  std::memcpy(&v, p, sizeof(T));
+  return v;
+}
+
+// Widening loads: exactly integral_vec*_t::size() pixels are read.
+#if INSTRSET >= 8
+inline Vec16us loadWiden16(const uint8_t *p) { return _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)p)); }
+#else
+inline Vec8us loadWiden16(const uint8_t *p) { return Vec8us(extend_low(Vec16uc(_mm_loadl_epi64((const __m128i *)p)))); }
+#endif
+#if INSTRSET >= 9
+inline Vec16ui loadWiden32(const uint8_t *p) { return _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *)p)); }
+inline Vec16ui loadWiden32(const int8_t *p) { return _mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i *)p)); }
+inline Vec16ui loadWiden32(const uint16_t *p) { return _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *)p)); }
+inline Vec16ui loadWiden32(const int16_t *p) { return _mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i *)p)); }
+inline Vec8uq loadWiden64(const uint8_t *p) { return _mm512_cvtepu8_epi64(_mm_loadl_epi64((const __m128i *)p)); }
+inline Vec8uq loadWiden64(const int8_t *p) { return _mm512_cvtepi8_epi64(_mm_loadl_epi64((const __m128i *)p)); }
+inline Vec8uq loadWiden64(const uint16_t *p) { return _mm512_cvtepu16_epi64(_mm_loadu_si128((const __m128i *)p)); }
+inline Vec8uq loadWiden64(const int16_t *p) { return _mm512_cvtepi16_epi64(_mm_loadu_si128((const __m128i *)p)); }
+inline Vec8uq loadWiden64(const uint32_t *p) { return _mm512_cvtepu32_epi64(_mm256_loadu_si256((const __m256i *)p)); }
+inline Vec8uq loadWiden64(const int32_t *p) { return _mm512_cvtepi32_epi64(_mm256_loadu_si256((const __m256i *)p)); }
+#elif INSTRSET >= 8
+inline Vec8ui loadWiden32(const uint8_t *p) { return _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)p)); }
+inline Vec8ui loadWiden32(const int8_t *p) { return _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i *)p)); }
+inline Vec8ui loadWiden32(const uint16_t *p) { return _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)p)); }
+inline Vec8ui loadWiden32(const int16_t *p) { return _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)p)); }
+inline Vec4uq loadWiden64(const uint8_t *p) { return _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(loadUnaligned<int32_t>(p))); }
+inline Vec4uq loadWiden64(const int8_t *p) { return _mm256_cvtepi8_epi64(_mm_cvtsi32_si128(loadUnaligned<int32_t>(p))); }
+inline Vec4uq loadWiden64(const uint16_t *p) { return _mm256_cvtepu16_epi64(_mm_loadl_epi64((const __m128i *)p)); }
+inline Vec4uq loadWiden64(const int16_t *p) { return _mm256_cvtepi16_epi64(_mm_loadl_epi64((const __m128i *)p)); }
+inline Vec4uq loadWiden64(const uint32_t *p) { return _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i *)p)); }
+inline Vec4uq loadWiden64(const int32_t *p) { return _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i *)p)); }
+#else
+inline Vec4ui loadWiden32(const uint8_t *p) { return Vec4ui(extend_low(extend_low(Vec16uc(_mm_cvtsi32_si128(loadUnaligned<int32_t>(p)))))); }
+inline Vec4ui loadWiden32(const int8_t *p) { return Vec4ui(extend_low(extend_low(Vec16c(_mm_cvtsi32_si128(loadUnaligned<int32_t>(p)))))); }
+inline Vec4ui loadWiden32(const uint16_t *p) { return Vec4ui(extend_low(Vec8us(_mm_loadl_epi64((const __m128i *)p)))); }
+inline Vec4ui loadWiden32(const int16_t *p) { return Vec4ui(extend_low(Vec8s(_mm_loadl_epi64((const __m128i *)p)))); }
+inline Vec2uq loadWiden64(const uint8_t *p) { return Vec2uq(extend_low(extend_low(extend_low(Vec16uc(_mm_cvtsi32_si128(loadUnaligned<uint16_t>(p))))))); }
+inline Vec2uq loadWiden64(const int8_t *p) { return Vec2uq(extend_low(extend_low(extend_low(Vec16c(_mm_cvtsi32_si128(loadUnaligned<int16_t>(p))))))); }
+inline Vec2uq loadWiden64(const uint16_t *p) { return Vec2uq(extend_low(Vec4ui(extend_low(Vec8us(_mm_cvtsi32_si128(loadUnaligned<int32_t>(p))))))); }
+inline Vec2uq loadWiden64(const int16_t *p) { return Vec2uq(extend_low(Vec4i(extend_low(Vec8s(_mm_cvtsi32_si128(loadUnaligned<int32_t>(p))))))); }
+inline Vec2uq loadWiden64(const uint32_t *p) { return Vec2uq(extend_low(Vec4ui(_mm_loadl_epi64((const __m128i *)p)))); }
+inline Vec2uq loadWiden64(const int32_t *p) { return Vec2uq(extend_low(Vec4i(_mm_loadl_epi64((const __m128i *)p)))); }
+#endif
+
+// Pixels as wide as the lanes, for integrals of their own type
+inline integral_vec32_t loadWiden32(const uint32_t *p) { integral_vec32_t v; v.load(p); return v; }
+inline integral_vec32_t loadWiden32(const int32_t *p) { integral_vec32_t v; v.load(p); return v; }
+inline integral_vec64_t loadWiden64(const uint64_t *p) { integral_vec64_t v; v.load(p); return v; }
+inline integral_vec64_t loadWiden64(const int64_t *p) { integral_vec64_t v; v.load(p); return v; }
+
+// Loads into float lanes go through the 32-bit widening loads, and loads
+// into double lanes convert floats or 32-bit integers.
+#if INSTRSET >= 9
+template <typename pixel_t>
+inline Vec16f loadWidenF(const pixel_t *p) { return _mm512_cvtepi32_ps(loadWiden32(p)); }
+inline Vec16f loadWidenF(const float *p) { return _mm512_loadu_ps(p); }
+inline Vec8d loadWidenD(const float *p) { return _mm512_cvtps_pd(_mm256_loadu_ps(p)); }
+inline Vec8d loadWidenD(const int32_t *p) { return _mm512_cvtepi32_pd(_mm256_loadu_si256((const __m256i *)p)); }
+inline Vec8d loadWidenD(const double *p) { return _mm512_loadu_pd(p); }
+#elif INSTRSET >= 8
+template <typename pixel_t>
+inline Vec8f loadWidenF(const pixel_t *p) { return _mm256_cvtepi32_ps(loadWiden32(p)); }
+inline Vec8f loadWidenF(const float *p) { return _mm256_loadu_ps(p); }
+inline Vec4d loadWidenD(const float *p) { return _mm256_cvtps_pd(_mm_loadu_ps(p)); }
+inline Vec4d loadWidenD(const int32_t *p) { return _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i *)p)); }
+inline Vec4d loadWidenD(const double *p) { return _mm256_loadu_pd(p); }
+#else
+template <typename pixel_t>
+inline Vec4f loadWidenF(const pixel_t *p) { return _mm_cvtepi32_ps(loadWiden32(p)); }
+inline Vec4f loadWidenF(const float *p) { return _mm_loadu_ps(p); }
+inline Vec2d loadWidenD(const float *p) { return _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i *)p))); }
+inline Vec2d loadWidenD(const int32_t *p) { return _mm_cvtepi32_pd(_mm_loadl_epi64((const __m128i *)p)); }
+inline Vec2d loadWidenD(const double *p) { return _mm_loadu_pd(p); }
+#endif
+
+// Inclusive prefix sum of the elements of a vector
+inline Vec8us scanVector(const Vec8us& a)
+{
+  __m128i s = _mm_add_epi16(a, _mm_slli_si128(a, 2));
+  s = _mm_add_epi16(s, _mm_slli_si128(s, 4));
+  return _mm_add_epi16(s, _mm_slli_si128(s, 8));
+}
+
+inline Vec4ui scanVector(const Vec4ui& a)
+{
+  __m128i s = _mm_add_epi32(a, _mm_slli_si128(a, 4));
+  return _mm_add_epi32(s, _mm_slli_si128(s, 8));
+}
+
+inline Vec2uq scanVector(const Vec2uq& a)
+{
+  return _mm_add_epi64(a, _mm_slli_si128(a, 8));
+}
+
+inline Vec4f scanVector(const Vec4f& a)
+{
+  __m128 s = _mm_add_ps(a, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(a), 4)));
+  return _mm_add_ps(s, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(s), 8)));
+}
+
+inline Vec2d scanVector(const Vec2d& a)
+{
+  return _mm_add_pd(a, _mm_castsi128_pd(_mm_slli_si128(_mm_castpd_si128(a), 8)));
+}
+
+#if INSTRSET >= 8
+inline Vec16us scanVector(const Vec16us& a)
+{
+  __m256i s = _mm256_add_epi16(a, _mm256_slli_si256(a, 2));
+  s = _mm256_add_epi16(s, _mm256_slli_si256(s, 4));
+  s = _mm256_add_epi16(s, _mm256_slli_si256(s, 8));
+  __m256i c = _mm256_permute2x128_si256(s, s, 0x08);
+  c = _mm256_shufflehi_epi16(c, 0xFF);
+  return _mm256_add_epi16(s, _mm256_unpackhi_epi64(c, c));
+}
+
+inline Vec8ui scanVector(const Vec8ui& a)
+{
+  __m256i s = _mm256_add_epi32(a, _mm256_slli_si256(a, 4));
+  s = _mm256_add_epi32(s, _mm256_slli_si256(s, 8));
+  // carry the last element of the low 128 bits into the high 128 bits
+  __m256i c = _mm256_permute2x128_si256(s, s, 0x08);
+  return _mm256_add_epi32(s, _mm256_shuffle_epi32(c, 0xFF));
+}
+
+inline Vec4uq scanVector(const Vec4uq& a)
+{
+  __m256i s = _mm256_add_epi64(a, _mm256_slli_si256(a, 8));
+  __m256i c = _mm256_permute2x128_si256(s, s, 0x08);
+  return _mm256_add_epi64(s, _mm256_shuffle_epi32(c, 0xEE));
+}
+
+inline Vec8f scanVector(const Vec8f& a)
+{
+  __m256 s = _mm256_add_ps(a, _mm256_castsi256_ps(_mm256_slli_si256(_mm256_castps_si256(a), 4)));
+  s = _mm256_add_ps(s, _mm256_castsi256_ps(_mm256_slli_si256(_mm256_castps_si256(s), 8)));
+  __m256 c = _mm256_permute2f128_ps(s, s, 0x08);
+  return _mm256_add_ps(s, _mm256_shuffle_ps(c, c, 0xFF));
+}
+
+inline Vec4d scanVector(const Vec4d& a)
+{
+  __m256d s = _mm256_add_pd(a, _mm256_castsi256_pd(_mm256_slli_si256(_mm256_castpd_si256(a), 8)));
+  __m256d c = _mm256_permute2f128_pd(s, s, 0x08);
+  return _mm256_add_pd(s, _mm256_shuffle_pd(c, c, 0xF));
+}
+#endif
+
+#if INSTRSET >= 9
+inline Vec16ui scanVector(const Vec16ui& a)
+{
+  Vec16ui s = a + permute16ui<-1,0,1,2,3,4,5,6,7,8,9,10,11,12,13,14>(a);
+  s += permute16ui<-1,-1,0,1,2,3,4,5,6,7,8,9,10,11,12,13>(s);
+  s += permute16ui<-1,-1,-1,-1,0,1,2,3,4,5,6,7,8,9,10,11>(s);
+  return s + permute16ui<-1,-1,-1,-1,-1,-1,-1,-1,0,1,2,3,4,5,6,7>(s);
+}
+
+inline Vec8uq scanVector(const Vec8uq& a)
+{
+  Vec8uq s = a + permute8uq<-1,0,1,2,3,4,5,6>(a);
+  s += permute8uq<-1,-1,0,1,2,3,4,5>(s);
+  return s + permute8uq<-1,-1,-1,-1,0,1,2,3>(s);
+}
+
+inline Vec16f scanVector(const Vec16f& a)
+{
+  Vec16f s = a + permute16f<-1,0,1,2,3,4,5,6,7,8,9,10,11,12,13,14>(a);
+  s += permute16f<-1,-1,0,1,2,3,4,5,6,7,8,9,10,11,12,13>(s);
+  s += permute16f<-1,-1,-1,-1,0,1,2,3,4,5,6,7,8,9,10,11>(s);
+  return s + permute16f<-1,-1,-1,-1,-1,-1,-1,-1,0,1,2,3,4,5,6,7>(s);
+}
+
+inline Vec8d scanVector(const Vec8d& a)
+{
+  Vec8d s = a + permute8d<-1,0,1,2,3,4,5,6>(a);
+  s += permute8d<-1,-1,0,1,2,3,4,5>(s);
+  return s + permute8d<-1,-1,-1,-1,0,1,2,3>(s);
+}
+#endif
+
+// Broadcast of the last element of a vector
+inline Vec8us broadcastLast(const Vec8us& a) { __m128i h = _mm_shufflehi_epi16(a, 0xFF); return _mm_unpackhi_epi64(h, h); }
+inline Vec4ui broadcastLast(const Vec4ui& a) { return _mm_shuffle_epi32(a, 0xFF); }
+inline Vec2uq broadcastLast(const Vec2uq& a) { return _mm_shuffle_epi32(a, 0xEE); }
+inline Vec4f broadcastLast(const Vec4f& a) { return _mm_shuffle_ps(a, a, 0xFF); }
+inline Vec2d broadcastLast(const Vec2d& a) { return _mm_unpackhi_pd(a, a); }
+#if INSTRSET >= 8
+inline Vec16us broadcastLast(const Vec16us& a) { return permute16us<15,15,15,15,15,15,15,15,15,15,15,15,15,15,15,15>(a); }
+inline Vec8ui broadcastLast(const Vec8ui& a) { return permute8ui<7,7,7,7,7,7,7,7>(a); }
+inline Vec4uq broadcastLast(const Vec4uq& a) { return permute4uq<3,3,3,3>(a); }
+inline Vec8f broadcastLast(const Vec8f& a) { return permute8f<7,7,7,7,7,7,7,7>(a); }
+inline Vec4d broadcastLast(const Vec4d& a) { return permute4d<3,3,3,3>(a); }
+#endif
+#if INSTRSET >= 9
+inline Vec16ui broadcastLast(const Vec16ui& a) { return permute16ui<15,15,15,15,15,15,15,15,15,15,15,15,15,15,15,15>(a); }
+inline Vec8uq broadcastLast(const Vec8uq& a) { return permute8uq<7,7,7,7,7,7,7,7>(a); }
+inline Vec16f broadcastLast(const Vec16f& a) { return permute16f<15,15,15,15,15,15,15,15,15,15,15,15,15,15,15,15>(a); }
+inline Vec8d broadcastLast(const Vec8d& a) { return permute8d<7,7,7,7,7,7,7,7>(a); }
+#endif
+
+// Squares of the pixels in 64-bit lanes, with the 32x32->64 bit multiply.
+// Signed pixels are squared by their magnitude, which fits in 32 bits.
+#if INSTRSET >= 9
+inline Vec8uq squareLow32(const Vec8uq& a) { return _mm512_mul_epu32(a, a); }
+#elif INSTRSET >= 8
+inline Vec4uq squareLow32(const Vec4uq& a) { return _mm256_mul_epu32(a, a); }
+#else
+inline Vec2uq squareLow32(const Vec2uq& a) { return _mm_mul_epu32(a, a); }
+#endif
+
+inline integral_vec64_t absolute64(const integral_vec64_t& a)
+{
+  const integral_vec64_t sign = integral_vec64_t(0) - (a >> 63);
+  return (a ^ sign) - sign;
+}
+
+inline integral_vec64_t loadSquare64(const uint8_t *p) { return squareLow32(loadWiden64(p)); }
+inline integral_vec64_t loadSquare64(const int8_t *p) { return squareLow32(absolute64(loadWiden64(p))); }
+inline integral_vec64_t loadSquare64(const uint16_t *p) { return squareLow32(loadWiden64(p)); }
+inline integral_vec64_t loadSquare64(const int16_t *p) { return squareLow32(absolute64(loadWiden64(p))); }
+inline integral_vec64_t loadSquare64(const uint32_t *p) { return squareLow32(loadWiden64(p)); }
+inline integral_vec64_t loadSquare64(const int32_t *p) { return squareLow32(absolute64(loadWiden64(p))); }
+
+template <typename pixel_t>
+inline integral_vecd_t loadSquareD(const pixel_t *p)
+{
+  const integral_vecd_t v = loadWidenD(p);
+  return v * v;
+}
+
+// Vector type and widening load for every integral type. A new integral
+// type costs an entry here, and a new pair of types an entry in
+// simd_integrable below.
+template <typename integral_t> struct integral_lane;
+
+template <> struct integral_lane<uint16_t> {
+  typedef integral_vec16_t vec_t;
+  template <typename pixel_t>
+  static inline vec_t load(const pixel_t *p) { return loadWiden16(p); }
+};
+
+template <> struct integral_lane<int32_t> {
+  typedef integral_vec32_t vec_t;
+  template <typename pixel_t>
+  static inline vec_t load(const pixel_t *p) { return loadWiden32(p); }
+};
+
+template <> struct integral_lane<uint32_t> : integral_lane<int32_t> {};
+
+template <> struct integral_lane<int64_t> {
+  typedef integral_vec64_t vec_t;
+  template <typename pixel_t>
+  static inline vec_t load(const pixel_t *p) { return loadWiden64(p); }
+  template <typename pixel_t>
+  static inline vec_t loadSquare(const pixel_t *p) { return loadSquare64(p); }
+};
+
+template <> struct integral_lane<uint64_t> : integral_lane<int64_t> {};
+
+template <> struct integral_lane<float> {
+  typedef integral_vecf_t vec_t;
+  template <typename pixel_t>
+  static inline vec_t load(const pixel_t *p) { return loadWidenF(p); }
+};
+
+template <> struct integral_lane<double> {
+  typedef integral_vecd_t vec_t;
+  template <typename pixel_t>
+  static inline vec_t load(const pixel_t *p) { return loadWidenD(p); }
+  template <typename pixel_t>
+  static inline vec_t loadSquare(const pixel_t *p) { return loadSquareD(p); }
+};
+
+// Integral types having a vector lane
+template <typename integral_t> struct simd_scannable : std::false_type {};
+template <> struct simd_scannable<uint16_t> : std::true_type {};
+template <> struct simd_scannable<int32_t> : std::true_type {};
+template <> struct simd_scannable<uint32_t> : std::true_type {};
+template <> struct simd_scannable<int64_t> : std::true_type {};
+template <> struct simd_scannable<uint64_t> : std::true_type {};
+template <> struct simd_scannable<float> : std::true_type {};
+template <> struct simd_scannable<double> : std::true_type {};
+
+// Pairs of (pixel_t, integral_t) having a vectorized line kernel
+template <typename pixel_t, typename integral_t> struct simd_integrable : std::false_type {};
+template <> struct simd_integrable<uint8_t, uint16_t> : std::true_type {};
+template <> struct simd_integrable<int8_t, int32_t> : std::true_type {};
+template <> struct simd_integrable<uint8_t, uint32_t> : std::true_type {};
+template <> struct simd_integrable<int16_t, int32_t> : std::true_type {};
+template <> struct simd_integrable<uint16_t, uint32_t> : std::true_type {};
+template <> struct simd_integrable<int8_t, int64_t> : std::true_type {};
+template <> struct simd_integrable<uint8_t, uint64_t> : std::true_type {};
+template <> struct simd_integrable<int16_t, int64_t> : std::true_type {};
+template <> struct simd_integrable<uint16_t, uint64_t> : std::true_type {};
+template <> struct simd_integrable<int32_t, int64_t> : std::true_type {};
+template <> struct simd_integrable<uint32_t, uint64_t> : std::true_type {};
+template <> struct simd_integrable<int32_t, int32_t> : std::true_type {};
+template <> struct simd_integrable<uint32_t, uint32_t> : std::true_type {};
+template <> struct simd_integrable<int64_t, int64_t> : std::true_type {};
+template <> struct simd_integrable<uint64_t, uint64_t> : std::true_type {};
+template <> struct simd_integrable<int8_t, float> : std::true_type {};
+template <> struct simd_integrable<uint8_t, float> : std::true_type {};
+template <> struct simd_integrable<int16_t, float> : std::true_type {};
+template <> struct simd_integrable<uint16_t, float> : std::true_type {};
+template <> struct simd_integrable<float, float> : std::true_type {};
+template <> struct simd_integrable<float, double> : std::true_type {};
+template <> struct simd_integrable<int32_t, double> : std::true_type {};
+template <> struct simd_integrable<double, double> : std::true_type {};
+// The 128-bit adds lose to the scalar add/adc pair with SSE2 only
+#if defined(__SIZEOF_INT128__) && INSTRSET >= 8
+template <> struct simd_integrable<uint8_t, unsigned __int128> : std::true_type {};
+template <> struct simd_integrable<uint16_t, unsigned __int128> : std::true_type {};
+template <> struct simd_integrable<uint32_t, unsigned __int128> : std::true_type {};
+#endif
+
+// Pairs of (pixel_t, sq_integral_t) having a vectorized sum of squares
+template <typename pixel_t, typename sq_integral_t> struct simd_squarable : std::false_type {};
+template <> struct simd_squarable<int8_t, int64_t> : std::true_type {};
+template <> struct simd_squarable<uint8_t, uint64_t> : std::true_type {};
+template <> struct simd_squarable<int16_t, int64_t> : std::true_type {};
+template <> struct simd_squarable<uint16_t, uint64_t> : std::true_type {};
+template <> struct simd_squarable<int32_t, int64_t> : std::true_type {};
+template <> struct simd_squarable<uint32_t, uint64_t> : std::true_type {};
+template <> struct simd_squarable<float, double> : std::true_type {};
+template <> struct simd_squarable<int32_t, double> : std::true_type {};
+template <> struct simd_squarable<double, double> : std::true_type {};
+
+template <typename pixel_t, typename integral_t>
+inline void integrateLineSIMD(const pixel_t *pixLine, const integral_t *prevLine, integral_t *intLine, size_t width, std::true_type)
+{
+  typedef integral_lane<integral_t> lane_t;
+  typedef typename lane_t::vec_t vec_t;
+  const size_t n = vec_t::size();
+
+  vec_t carry(0);
+  size_t x = 0;
+  for (; x + n <= width; x += n) {
+    vec_t sumVec = scanVector(lane_t::load(pixLine + x)) + carry;
+    carry = broadcastLast(sumVec);
+    vec_t prevVec;
+    prevVec.load(prevLine + x);
+    (sumVec + prevVec).store(intLine + x);
+  }
+
+  integral_t sum = (integral_t)carry[0];
+  for (; x < width; ++x) {
+    sum += (integral_t)pixLine[x];
+    intLine[x] = prevLine[x] + sum;
+  }
+}
+
+template <typename pixel_t, typename integral_t>
+inline void integrateLineSIMD(const pixel_t *pixLine, const integral_t *prevLine, integral_t *intLine, size_t width, std::false_type)
+{
+  integrateLineScalar(pixLine, prevLine, intLine, width);
+}
+
+// Same as integrateLineSIMD on the squares of the pixels
+template <typename pixel_t, typename sq_integral_t>
+inline void integrateLineSquaredSIMD(const pixel_t *pixLine, const sq_integral_t *prevLine, sq_integral_t *sqLine, size_t width, std::true_type)
+{
+  typedef integral_lane<sq_integral_t> lane_t;
+  typedef typename lane_t::vec_t vec_t;
+  const size_t n = vec_t::size();
+
+  vec_t carry(0);
+  size_t x = 0;
+  for (; x + n <= width; x += n) {
+    vec_t sumVec = scanVector(lane_t::loadSquare(pixLine + x)) + carry;
+    carry = broadcastLast(sumVec);
+    vec_t prevVec;
+    prevVec.load(prevLine + x);
+    (sumVec + prevVec).store(sqLine + x);
+  }
+
+  sq_integral_t sum = (sq_integral_t)carry[0];
+  for (; x < width; ++x) {
+    sum += (sq_integral_t)pixLine[x] * (sq_integral_t)pixLine[x];
+    sqLine[x] = prevLine[x] + sum;
+  }
+}
+
+template <typename pixel_t, typename sq_integral_t>
+inline void integrateLineSquaredSIMD(const pixel_t *pixLine, const sq_integral_t *prevLine, sq_integral_t *sqLine, size_t width, std::false_type)
+{
+  sq_integral_t sum = 0;
+  for (size_t x = 0; x < width; ++x) {
+    sum += (sq_integral_t)pixLine[x] * (sq_integral_t)pixLine[x];
+    sqLine[x] = prevLine[x] + sum;
+  }
+}
+
+#if defined(__SIZEOF_INT128__)
+// 128-bit integrals are (lo, hi) pairs of 64-bit lanes in memory. A vector
+// of 64-bit values is spread over the low lanes of two vectors, and added
+// with the add-with-carry emulated: the carry out of a low lane is found
+// by an unsigned compare and moved up into its high lane.
+#if INSTRSET >= 9
+inline void spreadLow(const Vec8uq& v, Vec8uq& a, Vec8uq& b)
+{
+  a = permute8uq<0,-1,1,-1,2,-1,3,-1>(v);
+  b = permute8uq<4,-1,5,-1,6,-1,7,-1>(v);
+}
+
+inline Vec8uq carryUp(const Vec8uq& c)
+{
+  return permute8uq<-1,0,-1,2,-1,4,-1,6>(c);
+}
+#elif INSTRSET >= 8
+inline void spreadLow(const Vec4uq& v, Vec4uq& a, Vec4uq& b)
+{
+  a = permute4uq<0,-1,1,-1>(v);
+  b = permute4uq<2,-1,3,-1>(v);
+}
+
+inline Vec4uq carryUp(const Vec4uq& c)
+{
+  return permute4uq<-1,0,-1,2>(c);
+}
+#else
+inline void spreadLow(const Vec2uq& v, Vec2uq& a, Vec2uq& b)
+{
+  a = permute2uq<0,-1>(v);
+  b = permute2uq<1,-1>(v);
+}
+
+inline Vec2uq carryUp(const Vec2uq& c)
+{
+  return permute2uq<-1,0>(c);
+}
+#endif
+
+inline void addVector128(const unsigned __int128 *src, const integral_vec64_t& v, unsigned __int128 *dst)
+{
+  const size_t half = integral_vec64_t::size() / 2;
+  integral_vec64_t a, b, va, vb;
+  spreadLow(v, va, vb);
+  a.load(src);
+  b.load(src + half);
+  a += va;
+  b += vb;
+  a += carryUp(select(a < va, integral_vec64_t(1), integral_vec64_t(0)));
+  b += carryUp(select(b < vb, integral_vec64_t(1), integral_vec64_t(0)));
+  a.store(dst);
+  b.store(dst + half);
+}
+
+// The running row sum is kept in 64-bit lanes, which holds any row of
+// fewer than 2^32 pixels of up to 32 bits.
+template <typename pixel_t>
+inline void integrateLineSIMD(const pixel_t *pixLine, const unsigned __int128 *prevLine, unsigned __int128 *intLine,
+			      size_t width, std::true_type)
+{
+  const size_t n = integral_vec64_t::size();
+
+  integral_vec64_t carry(0);
+  size_t x = 0;
+  for (; x + n <= width; x += n) {
+    integral_vec64_t sumVec = scanVector(loadWiden64(pixLine + x)) + carry;
+    carry = broadcastLast(sumVec);
+    addVector128(prevLine + x, sumVec, intLine + x);
+  }
+
+  uint64_t sum = carry[0];
+  for (; x < width; ++x) {
+    sum += (uint64_t)pixLine[x];
+    intLine[x] = prevLine[x] + sum;
+  }
+}
+#endif
+
+// In-place inclusive prefix sum of a line of integrals
+template <typename integral_t>
+inline void scanLineSIMD(integral_t *line, size_t width)
+{
+  typedef typename integral_lane<integral_t>::vec_t vec_t;
+  const size_t n = vec_t::size();
+
+  vec_t carry(0);
+  size_t x = 0;
+  for (; x + n <= width; x += n) {
+    vec_t sumVec;
+    sumVec.load(line + x);
+    sumVec = scanVector(sumVec) + carry;
+    carry = broadcastLast(sumVec);
+    sumVec.store(line + x);
+  }
+
+  integral_t sum = (integral_t)carry[0];
+  for (; x < width; ++x) line[x] = (sum += line[x]);
+}
+
+// False as soon as an element is smaller than the one on its left, as
+// unsigned integers, which is how a wrapped unsigned integral shows up.
+template <typename integral_t>
+inline bool isNondecreasingLineSIMD(const integral_t *line, size_t width)
+{
+  typedef typename integral_lane<integral_t>::vec_t vec_t;
+  const size_t n = vec_t::size();
+
+  size_t x = 1;
+  for (; x + n <= width; x += n) {
+    vec_t currVec, leftVec;
+    currVec.load(line + x);
+    leftVec.load(line + x - 1);
+    if (horizontal_or(currVec < leftVec)) return false;
+  }
+
+  for (; x < width; ++x) {
+    if (line[x] < line[x-1]) return false;
+  }
+  return true;
+}
+
+// Vertical step of the slow integrators: intLine = sumLine + pixLine with
+// widening loads, and a partial vector for the last width % N pixels so
+// that nothing past the end of the row is read or written.
+template <typename pixel_t, typename integral_t>
+inline void accumulateLineSIMD(const pixel_t *pixLine, const integral_t *sumLine, integral_t *intLine, size_t width)
+{
+  typedef integral_lane<integral_t> lane_t;
+  typedef typename lane_t::vec_t vec_t;
+  const size_t n = vec_t::size();
+
+  size_t x = 0;
+  for (; x + n <= width; x += n) {
+    vec_t sumVec;
+    sumVec.load(sumLine + x);
+    (sumVec + lane_t::load(pixLine + x)).store(intLine + x);
+  }
+
+  if (x < width) {
+    const int rest = (int)(width - x);
+    pixel_t pixTail[16] = { 0 }; // at most 16 lanes
+    std::memcpy(pixTail, pixLine + x, rest * sizeof(pixel_t));
+    vec_t sumVec(0);
+    sumVec.load_partial(rest, sumLine + x);
+    (sumVec + lane_t::load(pixTail)).store_partial(rest, intLine + x);
+  }
+}
+
+// Sum of a line of pixels in integral_t, one chain per lane
+template <typename pixel_t, typename integral_t>
+inline integral_t sumLineSIMD(const pixel_t *pixLine, size_t width)
+{
+  typedef integral_lane<integral_t> lane_t;
+  typedef typename lane_t::vec_t vec_t;
+  const size_t n = vec_t::size();
+
+  vec_t sumVec(0);
+  size_t x = 0;
+  for (; x + n <= width; x += n) sumVec += lane_t::load(pixLine + x);
+
+  integral_t sum = horizontal_add(sumVec);
+  for (; x < width; ++x) sum += (integral_t)pixLine[x];
+  return sum;
+}
+
+// True when all the bytes are zero, from an OR of the whole line
+inline bool isZeroLineSIMD(const uint8_t *p, size_t bytes)
+{
+  const size_t n = integral_vec32_t::size() * sizeof(uint32_t);
+
+  integral_vec32_t orVec(0);
+  size_t i = 0;
+  for (; i + n <= bytes; i += n) {
+    integral_vec32_t v;
+    v.load(p + i);
+    orVec |= v;
+  }
+
+  uint64_t orWord = 0;
+  for (; i + 8 <= bytes; i += 8) orWord |= loadUnaligned<uint64_t>(p + i);
+  for (; i < bytes; ++i) orWord |= p[i];
+  return orWord == 0 && !horizontal_or(orVec != integral_vec32_t(0));
+}
+
+// Rounds pixel * scale to the nearest integer, clamped to [lo, hi]. The
+// max/min pick the bound on a NaN like the scalar kernel does.
+inline void quantizeLineSIMD(const float *pixLine, int32_t *fixLine, size_t width, float scale, float lo, float hi)
+{
+  const size_t n = integral_vecf_t::size();
+
+  size_t x = 0;
+  for (; x + n <= width; x += n) {
+    integral_vecf_t v;
+    v.load(pixLine + x);
+    round_to_int(min(max(v * scale, integral_vecf_t(lo)), integral_vecf_t(hi))).store(fixLine + x);
+  }
+  for (; x < width; ++x) {
+    float v = pixLine[x] * scale;
+    v = (v > lo) ? v : lo;
+    v = (v < hi) ? v : hi;
+    fixLine[x] = (int32_t)std::nearbyint(v);
+  }
+}
+
+#if defined(__SIZEOF_INT128__)
+template <typename pixel_t>
+inline void accumulateLineSIMD(const pixel_t *pixLine, const unsigned __int128 *sumLine, unsigned __int128 *intLine, size_t width)
+{
+  const size_t n = integral_vec64_t::size();
+
+  size_t x = 0;
+  for (; x + n <= width; x += n) addVector128(sumLine + x, loadWiden64(pixLine + x), intLine + x);
+  for (; x < width; ++x) intLine[x] = sumLine[x] + pixLine[x];
+}
+#endif
+
+#if defined(INTEGRAL_SIMD_NAMESPACE)
+}
+#endif
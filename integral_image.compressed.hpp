@@ -0,0 +1,71 @@
+/*
+  Copyright (C) 2017 Hoyoung Lee
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cassert>
+#include <limits>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#include <cpixmap.hpp>
+#include <cbufferpool.hpp>
+#include <cexecutor.hpp>
+#include <ccompressedintegral.hpp>
+#include <integral_image.hpp>
+
+// Integrates a pixmap straight into a ccompressedintegral. Only one tile
+// row of the full-width SAT, plus the row above it, is held at a time.
+template <typename pixel_t, typename integral_t>
+inline void integratePixmapCompressed(cpixmap<pixel_t>& pixmap, ccompressedintegral<integral_t>& compressed,
+				      cexecutor& executor = getDefaultExecutor())
+{
+  assert(!(std::numeric_limits<pixel_t>::is_signed ^ std::numeric_limits<integral_t>::is_signed));
+  assert(compressed.isMatched(pixmap));
+
+  const size_t width = pixmap.getWidth(), height = pixmap.getHeight();
+  const size_t n = compressed.getTileSize();
+  if (width == 0 || height == 0) return;
+
+  const size_t bytes4integral = ALIGN_BYTES(width * sizeof(integral_t));
+
+  executor.parallelFor(0, pixmap.getBands(), [&](size_t z0, size_t z1) {
+      // n rows of the strip, and the last row of the strip above
+      uint8_t *stripLines = getDefaultBufferPool().acquire((n + 1) * bytes4integral);
+      std::memset(stripLines, 0, (n + 1) * bytes4integral);
+      integral_t **lines = (integral_t **)getDefaultBufferPool().acquire(n * sizeof(integral_t *));
+      for (size_t j = 0; j < n; ++j) lines[j] = (integral_t *)(stripLines + j * bytes4integral);
+      integral_t *aboveLine = (integral_t *)(stripLines + n * bytes4integral);
+
+      for (size_t z = z0; z < z1; ++z) {
+	for (size_t ty = 0; ty < compressed.getTilesY(); ++ty) {
+	  const size_t y0 = ty * n, rows = std::min(n, height - y0);
+	  const integral_t *prevLine = aboveLine;
+	  if (ty == 0) std::memset(aboveLine, 0, bytes4integral);
+	  for (size_t j = 0; j < rows; ++j) {
+	    integrateLine(pixmap.getLine(y0 + j, z), prevLine, lines[j], width);
+	    prevLine = lines[j];
+	  }
+	  compressed.setStrip(ty, z, (ty > 0) ? aboveLine : NULL, lines, rows);
+	  std::memcpy(aboveLine, lines[rows - 1], width * sizeof(integral_t));
+	}
+      }
+
+      getDefaultBufferPool().release((uint8_t *)lines, n * sizeof(integral_t *));
+      getDefaultBufferPool().release(stripLines, (n + 1) * bytes4integral);
+    });
+}
@@ -0,0 +1,100 @@
+/*
+  Copyright (C) 2017 Hoyoung Lee
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Compile this file once per instruction set and link all the objects:
+//
+// g++ -O3 -I. -msse2 -c integral_image.dispatch.cpp -o integral_image.sse2.o
+// g++ -O3 -I. -mavx2 -mfma -c integral_image.dispatch.cpp -o integral_image.avx2.o
+// g++ -O3 -I. -mavx512f -mavx512bw -mavx512dq -mavx512vl -mfma
+//     -c integral_image.dispatch.cpp -o integral_image.avx512.o
+//
+// Only the line kernels are built here. vectorclass and the kernels live in
+// a namespace per instruction set, and the functions exported below have a
+// suffix of their own. Any other inline function, of cpixmap, of the buffer
+// pool, of the executor or of the standard library, would be emitted in
+// every object under the same name and the linker would keep one copy of
+// them at random, the AVX-512 one included. INTEGRAL_KERNELS_ONLY keeps
+// them out, and integratePixmapDispatch() in integral_image.dispatch.hpp
+// walks the pixmaps in the code of the caller, with its own flags.
+// The SSE2 object also carries instrset_detect() and getIntegralInstrSet().
+
+#if defined(__AVX512F__)
+# define VCL_NAMESPACE vcl_avx512
+# define INTEGRAL_SIMD_NAMESPACE integral_avx512
+# define INTEGRAL_DISPATCH_SUFFIX AVX512
+#elif defined(__AVX2__)
+# define VCL_NAMESPACE vcl_avx2
+# define INTEGRAL_SIMD_NAMESPACE integral_avx2
+# define INTEGRAL_DISPATCH_SUFFIX AVX2
+#else
+# define VCL_NAMESPACE vcl_sse2
+# define INTEGRAL_SIMD_NAMESPACE integral_sse2
+# define INTEGRAL_DISPATCH_SUFFIX SSE2
+#endif
+
+#define INTEGRAL_KERNELS_ONLY
+
+#include <cstdlib>
+#include <strings.h>
+#include <algorithm>
+
+#include <integral_image.dispatch.hpp>
+#include <integral_image.slow.SIMD.hpp>
+
+#define INTEGRAL_DISPATCH_CONCAT(name, suffix) name##suffix
+#define INTEGRAL_DISPATCH_EXPAND(name, suffix) INTEGRAL_DISPATCH_CONCAT(name, suffix)
+#define INTEGRAL_DISPATCH_NAME(name) INTEGRAL_DISPATCH_EXPAND(name, INTEGRAL_DISPATCH_SUFFIX)
+
+#define INTEGRAL_DISPATCH_DEFINE_VERTICAL(pixel_t, integral_t)		\
+  void INTEGRAL_DISPATCH_NAME(integrateVertically)(const pixel_t *pixLine, const integral_t *sumLine, integral_t *intLine, size_t width) \
+  {									\
+    INTEGRAL_SIMD_NAMESPACE::integrateVertically(pixLine, sumLine, intLine, width); \
+  }
+
+#define INTEGRAL_DISPATCH_DEFINE_SCAN(integral_t)			\
+  void INTEGRAL_DISPATCH_NAME(scanLine)(integral_t *line, size_t width) \
+  {									\
+    INTEGRAL_SIMD_NAMESPACE::scanLine(line, width, INTEGRAL_SIMD_NAMESPACE::simd_scannable<integral_t>()); \
+  }
+
+INTEGRAL_DISPATCH_PAIRS(INTEGRAL_DISPATCH_DEFINE_VERTICAL)
+INTEGRAL_DISPATCH_INTEGRALS(INTEGRAL_DISPATCH_DEFINE_SCAN)
+
+#if INSTRSET == 2
+# include <vectorclass/instrset_detect.cpp>
+
+int getIntegralInstrSet(void)
+{
+  static const int iset = [] {
+    int detected = VCL_NAMESPACE::instrset_detect();
+    // The AVX2 and AVX-512 objects are built with -mfma, and instrset_detect()
+    // does not check FMA3: without it, as under some hypervisors, stop at AVX
+    if (detected >= 8 && !VCL_NAMESPACE::hasFMA3()) detected = 7;
+    const char *env = std::getenv("INTEGRAL_INSTRSET");
+    if (env == NULL || *env == '\0') return detected;
+
+    int requested;
+    if (!strcasecmp(env, "sse2")) requested = 2;
+    else if (!strcasecmp(env, "avx2")) requested = 8;
+    else if (!strcasecmp(env, "avx512")) requested = 11;
+    else requested = std::atoi(env);
+    // Never go beyond what the CPU supports
+    return std::min(detected, requested);
+  }();
+  return iset;
+}
+#endif
@@ -0,0 +1,166 @@
+/*
+  Copyright (C) 2017 Hoyoung Lee
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#if !defined(INTEGRAL_KERNELS_ONLY)
+# include <cstring>
+# include <cassert>
+# include <limits>
+# include <cpixmap.hpp>
+# include <cbufferpool.hpp>
+# include <cexecutor.hpp>
+#endif
+
+// Runtime CPU dispatch of the kernels in integral_image.slow.SIMD.hpp.
+//
+// integral_image.dispatch.cpp is compiled once per instruction set and the
+// objects are linked together (see the top of that file). Those objects
+// export the line kernels alone, on raw pointers: the vertical step and
+// the horizontal scan of a row. integratePixmapDispatch() walks the
+// pixmaps and runs the executor here, in the code of the caller, and the
+// first call for a pair of types detects the instruction set with
+// instrset_detect() and binds the best kernels. The environment variable
+// INTEGRAL_INSTRSET caps the level, so that every ISA can be benchmarked on
+// the same machine: "sse2", "avx2", "avx512" or the INSTRSET number.
+
+// Detected instruction set, AVX (7) at most without FMA3, capped by
+// INTEGRAL_INSTRSET.
+int getIntegralInstrSet(void);
+
+// Pairs of (pixel_t, integral_t) compiled for every instruction set
+#define INTEGRAL_DISPATCH_PAIRS(PAIR)		\
+  PAIR(int8_t, int32_t)				\
+  PAIR(uint8_t, uint32_t)			\
+  PAIR(int16_t, int32_t)			\
+  PAIR(uint16_t, uint32_t)			\
+  PAIR(int8_t, int64_t)				\
+  PAIR(uint8_t, uint64_t)			\
+  PAIR(int16_t, int64_t)			\
+  PAIR(uint16_t, uint64_t)			\
+  PAIR(int32_t, int64_t)			\
+  PAIR(uint32_t, uint64_t)			\
+  PAIR(uint8_t, float)				\
+  PAIR(uint16_t, float)				\
+  PAIR(float, float)				\
+  PAIR(float, double)				\
+  PAIR(double, double)
+
+// Integral types of those pairs, for the horizontal scan
+#define INTEGRAL_DISPATCH_INTEGRALS(INTEGRAL)	\
+  INTEGRAL(int32_t)				\
+  INTEGRAL(uint32_t)				\
+  INTEGRAL(int64_t)				\
+  INTEGRAL(uint64_t)				\
+  INTEGRAL(float)				\
+  INTEGRAL(double)
+
+// intLine = sumLine + pixLine, and the inclusive prefix sum of a line
+#define INTEGRAL_DISPATCH_DECLARE_VERTICAL(suffix, pixel_t, integral_t) \
+  void integrateVertically##suffix(const pixel_t *pixLine, const integral_t *sumLine, integral_t *intLine, size_t width);
+#define INTEGRAL_DISPATCH_DECLARE_SCAN(suffix, integral_t) \
+  void scanLine##suffix(integral_t *line, size_t width);
+
+#define INTEGRAL_DISPATCH_DECLARE_VERTICAL_SSE2(pixel_t, integral_t) INTEGRAL_DISPATCH_DECLARE_VERTICAL(SSE2, pixel_t, integral_t)
+#define INTEGRAL_DISPATCH_DECLARE_VERTICAL_AVX2(pixel_t, integral_t) INTEGRAL_DISPATCH_DECLARE_VERTICAL(AVX2, pixel_t, integral_t)
+#define INTEGRAL_DISPATCH_DECLARE_VERTICAL_AVX512(pixel_t, integral_t) INTEGRAL_DISPATCH_DECLARE_VERTICAL(AVX512, pixel_t, integral_t)
+#define INTEGRAL_DISPATCH_DECLARE_SCAN_SSE2(integral_t) INTEGRAL_DISPATCH_DECLARE_SCAN(SSE2, integral_t)
+#define INTEGRAL_DISPATCH_DECLARE_SCAN_AVX2(integral_t) INTEGRAL_DISPATCH_DECLARE_SCAN(AVX2, integral_t)
+#define INTEGRAL_DISPATCH_DECLARE_SCAN_AVX512(integral_t) INTEGRAL_DISPATCH_DECLARE_SCAN(AVX512, integral_t)
+
+INTEGRAL_DISPATCH_PAIRS(INTEGRAL_DISPATCH_DECLARE_VERTICAL_SSE2)
+INTEGRAL_DISPATCH_PAIRS(INTEGRAL_DISPATCH_DECLARE_VERTICAL_AVX2)
+INTEGRAL_DISPATCH_PAIRS(INTEGRAL_DISPATCH_DECLARE_VERTICAL_AVX512)
+INTEGRAL_DISPATCH_INTEGRALS(INTEGRAL_DISPATCH_DECLARE_SCAN_SSE2)
+INTEGRAL_DISPATCH_INTEGRALS(INTEGRAL_DISPATCH_DECLARE_SCAN_AVX2)
+INTEGRAL_DISPATCH_INTEGRALS(INTEGRAL_DISPATCH_DECLARE_SCAN_AVX512)
+
+#if !defined(INTEGRAL_KERNELS_ONLY)
+template <typename pixel_t, typename integral_t>
+class cintegraldispatch {
+public:
+  typedef void vertical_t(const pixel_t *, const integral_t *, integral_t *, size_t);
+  typedef void scan_t(integral_t *, size_t);
+  struct kernels_t {
+    vertical_t *vertical;
+    scan_t *scan;
+  };
+
+  // Bound on the first call, once for all the threads
+  static const kernels_t& getKernels(void)
+  {
+    static const kernels_t kernels = select();
+    return kernels;
+  }
+
+private:
+  static kernels_t select(void)
+  {
+    // The AVX-512 object is built with BW, DQ and VL besides F
+    const int iset = getIntegralInstrSet();
+    kernels_t kernels;
+    if (iset >= 11) {
+      kernels.vertical = &integrateVerticallyAVX512;
+      kernels.scan = &scanLineAVX512;
+    } else if (iset >= 8) {
+      kernels.vertical = &integrateVerticallyAVX2;
+      kernels.scan = &scanLineAVX2;
+    } else {
+      kernels.vertical = &integrateVerticallySSE2;
+      kernels.scan = &scanLineSSE2;
+    }
+    return kernels;
+  }
+};
+
+// The passes of integratePixmap() in integral_image.slow.SIMD.hpp, on the
+// kernels of the instruction set of the CPU.
+template <typename pixel_t, typename integral_t>
+inline void integratePixmapDispatch(cpixmap<pixel_t>& pixmap, cpixmap<integral_t>& integral,
+				    cexecutor& executor = getDefaultExecutor())
+{
+  assert(!std::numeric_limits<integral_t>::is_integer ||
+	 !(std::numeric_limits<pixel_t>::is_signed ^ std::numeric_limits<integral_t>::is_signed));
+  assert(pixmap.isMatched(integral));
+  integral.detach();
+
+  const typename cintegraldispatch<pixel_t, integral_t>::kernels_t& kernels =
+    cintegraldispatch<pixel_t, integral_t>::getKernels();
+  const size_t width = pixmap.getWidth(), height = pixmap.getHeight();
+  size_t bytes4integral = ALIGN_BYTES(width * sizeof(integral_t));
+  uint8_t *zeroLine = getDefaultBufferPool().acquire(bytes4integral);
+  std::memset(zeroLine, 0, bytes4integral);
+
+  executor.parallelFor(0, width, [&](size_t x0, size_t x1) {
+      for (size_t z = 0; z < pixmap.getBands(); ++z) {
+	const integral_t *sumLine = (const integral_t *)zeroLine;
+	for (size_t y = 0; y < height; ++y) {
+	  integral_t *intLine = integral.getLine(y, z);
+	  kernels.vertical(pixmap.getLine(y, z) + x0, sumLine + x0, intLine + x0, x1 - x0);
+	  sumLine = intLine;
+	}
+      }
+    }, 64);
+
+  executor.parallelFor(0, integral.getBands() * height, [&](size_t r0, size_t r1) {
+      for (size_t r = r0; r < r1; ++r) kernels.scan(integral.getLine(r % height, r / height), width);
+    });
+
+  getDefaultBufferPool().release(zeroLine, bytes4integral);
+}
+#endif
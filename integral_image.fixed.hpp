@@ -0,0 +1,120 @@
+/*
+  Copyright (C) 2017 Hoyoung Lee
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+
+#include <cpixmap.hpp>
+#include <cbufferpool.hpp>
+#include <cexecutor.hpp>
+#include <integral_image.hpp>
+
+// Fixed-point integral images of floating-point pixels.
+//
+// Every pixel is rounded to the 32-bit integer nearest to pixel * scale,
+// and the integral is made of those in int64_t. Integer additions are
+// associative, so the integral is the same to the last bit whatever the
+// strips, the executor or the number of threads, while a float integral
+// depends on the order of its additions. A box sum is sumBox() / scale,
+// exact up to the rounding of each pixel to 1 / scale.
+//
+// Pixels beyond +-FIXED_PIXEL_MAX / scale are clamped, and the integral
+// holds up to 2^32 pixels of that magnitude.
+
+#define FIXED_PIXEL_MAX 2147483520.0f // largest float below 2^31
+
+// Largest power of two taking values up to maxAbs to fixed point; a power
+// of two keeps the float to fixed-point conversion free of extra rounding.
+inline double getFixedScale(double maxAbs)
+{
+  assert(maxAbs > 0);
+  int e;
+  std::frexp((double)FIXED_PIXEL_MAX / maxAbs, &e);
+  return std::ldexp(1.0, e - 1);
+}
+
+template <typename pixel_t>
+inline void quantizeLine(const pixel_t *pixLine, int32_t *fixLine, size_t width, pixel_t scale)
+{
+  const pixel_t lo = -(pixel_t)FIXED_PIXEL_MAX, hi = (pixel_t)FIXED_PIXEL_MAX;
+  for (size_t x = 0; x < width; ++x) {
+    pixel_t v = pixLine[x] * scale;
+    v = (v > lo) ? v : lo;
+    v = (v < hi) ? v : hi;
+    fixLine[x] = (int32_t)std::nearbyint(v);
+  }
+}
+
+#if defined(USE_SIMD) && (defined(__x86_64__) || defined(__i386__))
+inline void quantizeLine(const float *pixLine, int32_t *fixLine, size_t width, float scale)
+{
+  quantizeLineSIMD(pixLine, fixLine, width, scale, -FIXED_PIXEL_MAX, FIXED_PIXEL_MAX);
+}
+#endif
+
+// Row-parallel like integratePixmapStrips(): the strips quantize and
+// integrate their rows, and carryStrips() adds the bottom rows of the
+// strips above.
+template <typename pixel_t>
+inline void integratePixmapFixed(cpixmap<pixel_t>& pixmap, cpixmap<int64_t>& integral, double scale,
+				 cexecutor& executor = getDefaultExecutor())
+{
+  static_assert(!std::numeric_limits<pixel_t>::is_integer, "Integer pixels need no fixed point");
+  assert(pixmap.isMatched(integral));
+  integral.detach();
+  assert(scale > 0);
+
+  const size_t width = pixmap.getWidth(), height = pixmap.getHeight();
+  if (width == 0 || height == 0) return;
+  const size_t strips = std::max<size_t>(1, std::min(executor.getConcurrency(), height));
+
+  size_t bytes4integral = ALIGN_BYTES(width * sizeof(int64_t));
+  uint8_t *zeroLine = getDefaultBufferPool().acquire(bytes4integral);
+  std::memset(zeroLine, 0, bytes4integral);
+  uint8_t *carryLines = getDefaultBufferPool().acquire(strips * bytes4integral);
+
+  for (size_t z = 0; z < pixmap.getBands(); ++z) {
+    executor.run(strips, [&](size_t s) {
+	int32_t *fixLine = (int32_t *)getDefaultBufferPool().acquire(width * sizeof(int32_t));
+	const int64_t *prevLine = (const int64_t *)zeroLine;
+	for (size_t y = s * height / strips; y < (s + 1) * height / strips; ++y) {
+	  int64_t *intLine = integral.getLine(y, z);
+	  quantizeLine(pixmap.getLine(y, z), fixLine, width, (pixel_t)scale);
+	  integrateLine(fixLine, prevLine, intLine, width);
+	  prevLine = intLine;
+	}
+	getDefaultBufferPool().release((uint8_t *)fixLine, width * sizeof(int32_t));
+      });
+
+    carryStrips(integral, z, strips, carryLines, bytes4integral, executor);
+  }
+
+  getDefaultBufferPool().release(carryLines, strips * bytes4integral);
+  getDefaultBufferPool().release(zeroLine, bytes4integral);
+}
+
+// Sum of the w x h box at (x, y) of a fixed-point integral
+inline double sumFixedBox(const cpixmap<int64_t>& integral, double scale,
+			  size_t x, size_t y, size_t w, size_t h, size_t z = 0)
+{
+  return (double)sumBox(integral, x, y, w, h, z) / scale;
+}
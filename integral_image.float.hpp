@@ -0,0 +1,141 @@
+/*
+  Copyright (C) 2017 Hoyoung Lee
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cassert>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <type_traits>
+
+#include <cpixmap.hpp>
+#include <cbufferpool.hpp>
+#include <cexecutor.hpp>
+#include <cfloatintegral.hpp>
+#include <integral_image.hpp>
+
+// Sum of a line in double, on four chains
+template <typename pixel_t>
+inline double sumLineD(const pixel_t *pixLine, size_t width, std::false_type)
+{
+  double sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+  size_t x = 0;
+  for (; x + 4 <= width; x += 4) {
+    sum0 += (double)pixLine[x];
+    sum1 += (double)pixLine[x + 1];
+    sum2 += (double)pixLine[x + 2];
+    sum3 += (double)pixLine[x + 3];
+  }
+  for (; x < width; ++x) sum0 += (double)pixLine[x];
+  return (sum0 + sum1) + (sum2 + sum3);
+}
+
+template <typename pixel_t>
+inline void accumulateLineD(const pixel_t *pixLine, double *sumLine, size_t width, std::false_type)
+{
+  for (size_t x = 0; x < width; ++x) sumLine[x] += (double)pixLine[x];
+}
+
+#if defined(USE_SIMD) && (defined(__x86_64__) || defined(__i386__))
+template <typename pixel_t>
+inline double sumLineD(const pixel_t *pixLine, size_t width, std::true_type)
+{
+  return sumLineSIMD<pixel_t, double>(pixLine, width);
+}
+
+template <typename pixel_t>
+inline void accumulateLineD(const pixel_t *pixLine, double *sumLine, size_t width, std::true_type)
+{
+  accumulateLineSIMD(pixLine, sumLine, sumLine, width);
+}
+
+template <typename pixel_t>
+struct simd_doubled : simd_integrable<pixel_t, double> {};
+#else
+template <typename pixel_t>
+struct simd_doubled : std::false_type {};
+#endif
+
+// Integrates a pixmap into a cfloatintegral. The tile rows are independent
+// but for their above() rows: every tile row makes its local SATs, its
+// left() columns and the double SAT of its own bottom row, concurrently,
+// and the bottom rows are then summed down the tile rows. The local SATs
+// take the vectorized integrateLine() tile by tile.
+template <typename pixel_t, typename local_t>
+inline void integratePixmapFloat(cpixmap<pixel_t>& pixmap, cfloatintegral<local_t>& integral,
+				 cexecutor& executor = getDefaultExecutor())
+{
+  assert(integral.isMatched(pixmap));
+
+  const size_t width = pixmap.getWidth(), height = pixmap.getHeight();
+  const size_t n = integral.getTileSize(), tilesX = integral.getTilesX(), tilesY = integral.getTilesY();
+  if (width == 0 || height == 0) return;
+
+  const size_t bytes4local = ALIGN_BYTES(width * sizeof(local_t));
+  uint8_t *zeroLine = getDefaultBufferPool().acquire(bytes4local);
+  std::memset(zeroLine, 0, bytes4local);
+
+  executor.parallelFor(0, pixmap.getBands() * tilesY, [&](size_t s0, size_t s1) {
+      double *colSums = (double *)getDefaultBufferPool().acquire(width * sizeof(double));
+
+      for (size_t s = s0; s < s1; ++s) {
+	const size_t z = s / tilesY, ty = s % tilesY;
+	const size_t y0 = ty * n, rows = std::min(n, height - y0);
+	const local_t *prevLine = (const local_t *)zeroLine;
+	const double *prevLeft = (const double *)zeroLine;
+	std::fill(colSums, colSums + width, 0.0);
+
+	for (size_t j = 0; j < rows; ++j) {
+	  const pixel_t *pixLine = pixmap.getLine(y0 + j, z);
+	  local_t *localLine = integral.getLocalLine(y0 + j, z);
+	  double *leftLine = integral.getLeftLine(y0 + j, z);
+	  double rowSum = 0;
+	  for (size_t tx = 0; tx < tilesX; ++tx) {
+	    const size_t x0 = tx * n, cols = std::min(n, width - x0);
+	    integrateLine(pixLine + x0, prevLine + x0, localLine + x0, cols);
+	    leftLine[tx] = prevLeft[tx] + rowSum;
+	    rowSum += sumLineD(pixLine + x0, cols, simd_doubled<pixel_t>());
+	  }
+	  accumulateLineD(pixLine, colSums, width, simd_doubled<pixel_t>());
+	  prevLine = localLine;
+	  prevLeft = leftLine;
+	}
+
+	// The bottom row of the tile row alone, summed down below
+	if (ty + 1 < tilesY) {
+	  double *bottomLine = integral.getAboveLine(ty + 1, z);
+	  double sum = 0;
+	  for (size_t x = 0; x < width; ++x) bottomLine[x] = (sum += colSums[x]);
+	}
+      }
+
+      getDefaultBufferPool().release((uint8_t *)colSums, width * sizeof(double));
+    });
+
+  executor.parallelFor(0, width, [&](size_t x0, size_t x1) {
+      for (size_t z = 0; z < pixmap.getBands(); ++z) {
+	std::fill(integral.getAboveLine(0, z) + x0, integral.getAboveLine(0, z) + x1, 0.0);
+	for (size_t ty = 2; ty < tilesY; ++ty) {
+	  double *aboveLine = integral.getAboveLine(ty, z);
+	  const double *prevLine = integral.getAboveLine(ty - 1, z);
+	  for (size_t x = x0; x < x1; ++x) aboveLine[x] += prevLine[x];
+	}
+      }
+    }, 64);
+
+  getDefaultBufferPool().release(zeroLine, bytes4local);
+}
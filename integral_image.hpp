@@ -18,59 +18,266 @@
 
 #include <cassert>
 #include <limits>
-#include <iostream>
 #include <cstring>
 #include <cstdint>
 #include <algorithm>
 #include <type_traits>
 
 #include <cpixmap.hpp>
+#include <cbufferpool.hpp>
 #include <power_of_2.hpp>
+#include <cexecutor.hpp>
+#include <integral_image.traits.hpp>
 
-// In general, non-SIMD integralPixmap is much faster than the SIMDed.
+// Every row of the integral image is a running sum along the row added to
+// the previous integral row. With USE_SIMD on x86, the supported pairs of
+// (pixel_t, integral_t) take the in-register prefix scan from
+// integral_image.SIMD.hpp, and the others fall back to the scalar kernels,
+// which integrate four rows at once.
 
-//#if !defined(USE_SIMD)
 template <typename pixel_t, typename integral_t>
-inline void integratePixmap(cpixmap<pixel_t>& pixmap, cpixmap<integral_t>& integral)
+inline void integrateLineScalar(const pixel_t *pixLine, const integral_t *prevLine, integral_t *intLine, size_t width)
 {
-  assert(!(std::numeric_limits<pixel_t>::is_signed ^ std::numeric_limits<integral_t>::is_signed));
-  assert(pixmap.isMatched(integral));
+  integral_t sum = 0;
+  for (size_t x = 0; x < width; ++x) {
+    sum += (integral_t)pixLine[x];
+    intLine[x] = prevLine[x] + sum;
+  }
+}
 
-  if (std::numeric_limits<integral_t>::digits <
-      (std::numeric_limits<pixel_t>::digits +
-       ilog2(ceilPowerOf2((uint32_t)pixmap.getWidth())) +
-       ilog2(ceilPowerOf2((uint32_t)pixmap.getHeight())))) {
-    std::cout << "Warning!: Integral pixmap doesn't fully contain the result from image pixmap!" << std::endl;
+// Four rows at once: the four running row sums are independent chains
+// kept in registers, so the CPU overlaps them instead of waiting on a
+// single one.
+template <typename pixel_t, typename integral_t>
+inline void integrateLinesScalar(const pixel_t *pix0Line, const pixel_t *pix1Line,
+				 const pixel_t *pix2Line, const pixel_t *pix3Line,
+				 const integral_t *prevLine,
+				 integral_t *int0Line, integral_t *int1Line,
+				 integral_t *int2Line, integral_t *int3Line, size_t width)
+{
+  integral_t sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+  for (size_t x = 0; x < width; ++x) {
+    sum0 += (integral_t)pix0Line[x];
+    sum1 += (integral_t)pix1Line[x];
+    sum2 += (integral_t)pix2Line[x];
+    sum3 += (integral_t)pix3Line[x];
+    const integral_t int0 = prevLine[x] + sum0;
+    const integral_t int1 = int0 + sum1;
+    const integral_t int2 = int1 + sum2;
+    int0Line[x] = int0;
+    int1Line[x] = int1;
+    int2Line[x] = int2;
+    int3Line[x] = int2 + sum3;
   }
-  
-  size_t bytes4integral = ALIGN_BYTES((integral.getWidth() + 1) * sizeof(integral_t));
-  
-#pragma omp parallel for
-  for (size_t z = 0; z < pixmap.getBands(); ++z) {
-    uint8_t *temp1Line = new uint8_t[bytes4integral];
-    std::memset(temp1Line, 0, bytes4integral);
-    integral_t *prevLine = (integral_t *)temp1Line + 1;
-    
-    uint8_t *temp2Line = new uint8_t[bytes4integral];
-    std::memset(temp2Line, 0, bytes4integral);
-    integral_t *currLine = (integral_t *)temp2Line + 1;
-    
-    for (size_t y = 0; y < pixmap.getHeight(); ++y) {
-      pixel_t *pixLine = pixmap.getLine(y, z);
-      //integral_t *intLine = integral.getLine(y, z);
-      //integral.readHLine(currLine, integral.getWidth(), 0, y, z);
-      for (size_t x = 0; x < pixmap.getWidth(); ++x) {
-	currLine[(int)x] = prevLine[(int)x] - prevLine[(int)x-1] + currLine[(int)x-1] + (integral_t)pixLine[x];
-      }
-      integral.writeHLine(currLine, integral.getWidth(), 0, y, z);
-      std::swap(prevLine, currLine);
-    }
-    delete [] temp1Line;
-    delete [] temp2Line;
+}
+
+// Sum and sum of squares of one row from a single read of the pixels
+template <typename pixel_t, typename integral_t, typename sq_integral_t>
+inline void integrateLineSquaredScalar(const pixel_t *pixLine,
+				       const integral_t *prevLine, const sq_integral_t *prevSqLine,
+				       integral_t *intLine, sq_integral_t *sqLine, size_t width)
+{
+  integral_t sum = 0;
+  sq_integral_t sqSum = 0;
+  for (size_t x = 0; x < width; ++x) {
+    const sq_integral_t pixel = (sq_integral_t)pixLine[x];
+    sum += (integral_t)pixLine[x];
+    sqSum += pixel * pixel;
+    intLine[x] = prevLine[x] + sum;
+    sqLine[x] = prevSqLine[x] + sqSum;
   }
 }
-/*
+
+#if defined(USE_SIMD) && (defined(__x86_64__) || defined(__i386__))
+# include "integral_image.SIMD.hpp"
+#endif
+
+template <typename pixel_t, typename integral_t>
+inline void integrateLine(const pixel_t *pixLine, const integral_t *prevLine, integral_t *intLine, size_t width)
+{
+#if defined(USE_SIMD) && (defined(__x86_64__) || defined(__i386__))
+  integrateLineSIMD(pixLine, prevLine, intLine, width, simd_integrable<pixel_t, integral_t>());
 #else
-# include "integral_image.slow.SIMD.hpp"
+  integrateLineScalar(pixLine, prevLine, intLine, width);
 #endif
-*/
+}
+
+// With USE_SIMD the two scans run one after the other on the same row of
+// pixels, which is still in L1 for the second one.
+template <typename pixel_t, typename integral_t, typename sq_integral_t>
+inline void integrateLineSquared(const pixel_t *pixLine,
+				 const integral_t *prevLine, const sq_integral_t *prevSqLine,
+				 integral_t *intLine, sq_integral_t *sqLine, size_t width)
+{
+#if defined(USE_SIMD) && (defined(__x86_64__) || defined(__i386__))
+  integrateLineSIMD(pixLine, prevLine, intLine, width, simd_integrable<pixel_t, integral_t>());
+  integrateLineSquaredSIMD(pixLine, prevSqLine, sqLine, width, simd_squarable<pixel_t, sq_integral_t>());
+#else
+  integrateLineSquaredScalar(pixLine, prevLine, prevSqLine, intLine, sqLine, width);
+#endif
+}
+
+// Integrates the block [x0, x0+cols) x [y0, y0+rows) of band z on top of
+// prevLine, the integral row above the block (relative to x0), straight
+// into the integral pixmap.
+template <typename pixel_t, typename integral_t>
+inline void integrateBlock(cpixmap<pixel_t>& pixmap, cpixmap<integral_t>& integral,
+			   size_t x0, size_t cols, size_t y0, size_t rows, size_t z,
+			   const integral_t *prevLine)
+{
+  size_t y = 0;
+#if defined(USE_SIMD) && (defined(__x86_64__) || defined(__i386__))
+  if (!simd_integrable<pixel_t, integral_t>::value)
+#endif
+  for (; y + 4 <= rows; y += 4) {
+    integral_t *int3Line = integral.getLine(y0 + y + 3, z) + x0;
+    integrateLinesScalar(pixmap.getLine(y0 + y, z) + x0, pixmap.getLine(y0 + y + 1, z) + x0,
+			 pixmap.getLine(y0 + y + 2, z) + x0, pixmap.getLine(y0 + y + 3, z) + x0,
+			 prevLine,
+			 integral.getLine(y0 + y, z) + x0, integral.getLine(y0 + y + 1, z) + x0,
+			 integral.getLine(y0 + y + 2, z) + x0, int3Line, cols);
+    prevLine = int3Line;
+  }
+  for (; y < rows; ++y) {
+    integral_t *intLine = integral.getLine(y0 + y, z) + x0;
+    integrateLine(pixmap.getLine(y0 + y, z) + x0, prevLine, intLine, cols);
+    prevLine = intLine;
+  }
+}
+
+template <typename pixel_t, typename integral_t>
+inline void integratePixmap(cpixmap<pixel_t>& pixmap, cpixmap<integral_t>& integral,
+			    cexecutor& executor = getDefaultExecutor())
+{
+  assert(!std::numeric_limits<integral_t>::is_integer ||
+	 !(std::numeric_limits<pixel_t>::is_signed ^ std::numeric_limits<integral_t>::is_signed));
+  assert(pixmap.isMatched(integral));
+  integral.detach();
+
+  size_t bytes4integral = ALIGN_BYTES(integral.getWidth() * sizeof(integral_t));
+  uint8_t *zeroLine = getDefaultBufferPool().acquire(bytes4integral);
+  std::memset(zeroLine, 0, bytes4integral);
+  
+  executor.parallelFor(0, pixmap.getBands(), [&](size_t z0, size_t z1) {
+      for (size_t z = z0; z < z1; ++z) {
+	integrateBlock(pixmap, integral, 0, pixmap.getWidth(), 0, pixmap.getHeight(), z,
+		       (const integral_t *)zeroLine);
+      }
+    });
+  getDefaultBufferPool().release(zeroLine, bytes4integral);
+}
+
+// In-place integration, for a pixmap whose type holds its own integrals:
+// every row is scanned and added to the integral row above in the same
+// pass, and each pixel is read before its integral is written over it.
+template <typename T>
+inline void integratePixmap(cpixmap<T>& pixmap, cexecutor& executor = getDefaultExecutor())
+{
+  integratePixmap(pixmap, pixmap, executor);
+}
+
+// Integral image and integral of the squared image in one pass over the
+// pixels, for local variances (Sauvola, NCC) without a squared copy of the
+// image. sq_integral_t is usually twice as wide as integral_t.
+template <typename pixel_t, typename integral_t, typename sq_integral_t>
+inline void integratePixmapSquared(cpixmap<pixel_t>& pixmap, cpixmap<integral_t>& integral,
+				   cpixmap<sq_integral_t>& squared,
+				   cexecutor& executor = getDefaultExecutor())
+{
+  assert(!std::numeric_limits<integral_t>::is_integer ||
+	 !(std::numeric_limits<pixel_t>::is_signed ^ std::numeric_limits<integral_t>::is_signed));
+  assert(pixmap.isMatched(integral));
+  assert(pixmap.isMatched(squared));
+  integral.detach();
+  squared.detach();
+
+  const size_t width = pixmap.getWidth();
+  size_t bytes4integral = ALIGN_BYTES(width * std::max(sizeof(integral_t), sizeof(sq_integral_t)));
+  uint8_t *zeroLine = getDefaultBufferPool().acquire(bytes4integral);
+  std::memset(zeroLine, 0, bytes4integral);
+
+  executor.parallelFor(0, pixmap.getBands(), [&](size_t z0, size_t z1) {
+      for (size_t z = z0; z < z1; ++z) {
+	const integral_t *prevLine = (const integral_t *)zeroLine;
+	const sq_integral_t *prevSqLine = (const sq_integral_t *)zeroLine;
+	for (size_t y = 0; y < pixmap.getHeight(); ++y) {
+	  integral_t *intLine = integral.getLine(y, z);
+	  sq_integral_t *sqLine = squared.getLine(y, z);
+	  integrateLineSquared(pixmap.getLine(y, z), prevLine, prevSqLine, intLine, sqLine, width);
+	  prevLine = intLine;
+	  prevSqLine = sqLine;
+	}
+      }
+    });
+  getDefaultBufferPool().release(zeroLine, bytes4integral);
+}
+
+template <typename integral_t>
+inline void accumulateLine(integral_t *intLine, const integral_t *carryLine, size_t width)
+{
+  for (size_t x = 0; x < width; ++x) intLine[x] += carryLine[x];
+}
+
+// Second pass of the row-parallel integrators: band z holds strips integrated
+// each on its own, and the bottom row of every strip is carried into all
+// the strips below it. carryLines holds strips lines of bytes4integral.
+template <typename integral_t>
+inline void carryStrips(cpixmap<integral_t>& integral, size_t z, size_t strips,
+			uint8_t *carryLines, size_t bytes4integral, cexecutor& executor)
+{
+  const size_t width = integral.getWidth(), height = integral.getHeight();
+
+  // carryLines[s] accumulates the bottom rows of all the strips above s
+  std::memset(carryLines, 0, bytes4integral);
+  for (size_t s = 1; s < strips; ++s) {
+    integral_t *carryLine = (integral_t *)(carryLines + s * bytes4integral);
+    std::memcpy(carryLine, carryLines + (s - 1) * bytes4integral, width * sizeof(integral_t));
+    accumulateLine(carryLine, integral.getLine(s * height / strips - 1, z), width);
+  }
+
+  executor.parallelFor(height / strips, height, [&](size_t y0, size_t y1) {
+      size_t s = y0 * strips / height;
+      while ((s + 1) * height / strips <= y0) ++s;
+      while (s * height / strips > y0) --s;
+      for (size_t y = y0; y < y1; ++y) {
+	if ((s + 1) * height / strips <= y) ++s;
+	accumulateLine(integral.getLine(y, z), (const integral_t *)(carryLines + s * bytes4integral), width);
+      }
+    });
+}
+
+// Row-parallel integration inside each band: the band is split into
+// horizontal strips which are integrated concurrently, and then the bottom
+// row of every strip is carried into all the strips below it in a second
+// parallel pass. strips = 0 takes one strip per thread of the executor.
+template <typename pixel_t, typename integral_t>
+inline void integratePixmapStrips(cpixmap<pixel_t>& pixmap, cpixmap<integral_t>& integral, size_t strips = 0,
+				  cexecutor& executor = getDefaultExecutor())
+{
+  assert(!std::numeric_limits<integral_t>::is_integer ||
+	 !(std::numeric_limits<pixel_t>::is_signed ^ std::numeric_limits<integral_t>::is_signed));
+  assert(pixmap.isMatched(integral));
+  integral.detach();
+
+  const size_t width = pixmap.getWidth(), height = pixmap.getHeight();
+  if (strips == 0) strips = executor.getConcurrency();
+  strips = std::max<size_t>(1, std::min(strips, height));
+
+  size_t bytes4integral = ALIGN_BYTES(width * sizeof(integral_t));
+  uint8_t *zeroLine = getDefaultBufferPool().acquire(bytes4integral);
+  std::memset(zeroLine, 0, bytes4integral);
+  uint8_t *carryLines = getDefaultBufferPool().acquire(strips * bytes4integral);
+
+  for (size_t z = 0; z < pixmap.getBands(); ++z) {
+    executor.run(strips, [&](size_t s) {
+	const size_t y0 = s * height / strips;
+	integrateBlock(pixmap, integral, 0, width, y0, (s + 1) * height / strips - y0, z,
+		       (const integral_t *)zeroLine);
+      });
+
+    carryStrips(integral, z, strips, carryLines, bytes4integral, executor);
+  }
+
+  getDefaultBufferPool().release(carryLines, strips * bytes4integral);
+  getDefaultBufferPool().release(zeroLine, bytes4integral);
+}
@@ -0,0 +1,146 @@
+/*
+  Copyright (C) 2017 Hoyoung Lee
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cassert>
+#include <limits>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <new>
+
+#include <cpixmap.hpp>
+#include <cbufferpool.hpp>
+#include <cexecutor.hpp>
+#include <integral_image.hpp>
+#include <integral_image.tiled.hpp>
+
+// Single-pass parallel SAT with decoupled look-back.
+//
+// Workers claim tiles in row-major order from an atomic counter. A tile
+// makes its local SAT, publishes its right edge as the aggregate of the
+// tile, and resolves its carry column by looking back at the tiles on its
+// left: an inclusive prefix ends the look-back, an aggregate is added and
+// the look-back goes on. Once the carry column is known the inclusive prefix
+// is published, and the carries plus the last row of the tile above are
+// added while the tile is still in cache, so every integral is written once.
+// The tile above is claimed a whole tile row earlier, so waiting on it
+// seldom spins, and the row-major claim order guarantees progress even
+// when the executor runs fewer workers at once than it was asked for.
+
+enum LOOKBACK_STATUS {
+  LOOKBACK_INVALID = 0,
+  LOOKBACK_AGGREGATE = 1,
+  LOOKBACK_PREFIX = 2
+};
+
+template <typename pixel_t, typename integral_t>
+inline void integratePixmapLookback(cpixmap<pixel_t>& pixmap, cpixmap<integral_t>& integral,
+				    size_t tileWidth = 0, size_t tileHeight = 32,
+				    cexecutor& executor = getDefaultExecutor())
+{
+  assert(!std::numeric_limits<integral_t>::is_integer ||
+	 !(std::numeric_limits<pixel_t>::is_signed ^ std::numeric_limits<integral_t>::is_signed));
+  assert(pixmap.isMatched(integral));
+  integral.detach();
+
+  const size_t width = pixmap.getWidth(), height = pixmap.getHeight();
+  if (width == 0 || height == 0) return;
+
+  tileHeight = std::max<size_t>(1, std::min(tileHeight, height));
+  if (tileWidth == 0) tileWidth = INTEGRAL_TILE_BYTES / (tileHeight * sizeof(integral_t));
+  tileWidth = std::max<size_t>(1, std::min(tileWidth, width));
+
+  const size_t tilesX = (width + tileWidth - 1) / tileWidth;
+  const size_t tilesY = (height + tileHeight - 1) / tileHeight;
+  const size_t tiles = tilesX * tilesY;
+
+  size_t bytes4integral = ALIGN_BYTES(tileWidth * sizeof(integral_t));
+  uint8_t *zeroLine = getDefaultBufferPool().acquire(bytes4integral);
+  std::memset(zeroLine, 0, bytes4integral);
+
+  // The flags are trivially destructible atomics, made again for every band
+  const size_t bytes4status = tiles * sizeof(std::atomic<int>);
+  const size_t bytes4done = tiles * sizeof(std::atomic<bool>);
+  const size_t bytes4edges = tiles * tileHeight * sizeof(integral_t);
+  std::atomic<int> *status = (std::atomic<int> *)getDefaultBufferPool().acquire(bytes4status);
+  std::atomic<bool> *done = (std::atomic<bool> *)getDefaultBufferPool().acquire(bytes4done);
+  integral_t *aggregates = (integral_t *)getDefaultBufferPool().acquire(bytes4edges);
+  integral_t *prefixes = (integral_t *)getDefaultBufferPool().acquire(bytes4edges);
+
+  for (size_t z = 0; z < pixmap.getBands(); ++z) {
+    std::atomic<size_t> counter(0);
+    for (size_t t = 0; t < tiles; ++t) {
+      new (&status[t]) std::atomic<int>(LOOKBACK_INVALID);
+      new (&done[t]) std::atomic<bool>(false);
+    }
+
+    executor.run(executor.getConcurrency(), [&](size_t) {
+	integral_t *carryLine = (integral_t *)getDefaultBufferPool().acquire(tileHeight * sizeof(integral_t));
+
+	for (size_t t = counter++; t < tiles; t = counter++) {
+	  const size_t tx = t % tilesX, ty = t / tilesX;
+	  const size_t x0 = tx * tileWidth, y0 = ty * tileHeight;
+	  const size_t cols = std::min(tileWidth, width - x0);
+	  const size_t rows = std::min(tileHeight, height - y0);
+	  integral_t *aggregate = aggregates + t * tileHeight;
+	  integral_t *prefix = prefixes + t * tileHeight;
+
+	  // Local SAT of the tile, and its right edge as the aggregate
+	  integrateBlock(pixmap, integral, x0, cols, y0, rows, z, (const integral_t *)zeroLine);
+	  for (size_t y = 0; y < rows; ++y) aggregate[y] = integral.getLine(y0 + y, z)[x0 + cols - 1];
+	  status[t].store(LOOKBACK_AGGREGATE, std::memory_order_release);
+
+	  // Decoupled look-back over the tiles on the left
+	  std::fill(carryLine, carryLine + rows, integral_t(0));
+	  for (size_t p = t; p > ty * tilesX; --p) {
+	    int s;
+	    while ((s = status[p - 1].load(std::memory_order_acquire)) == LOOKBACK_INVALID)
+	      std::this_thread::yield();
+	    const integral_t *source = (s == LOOKBACK_PREFIX) ? prefixes + (p - 1) * tileHeight : aggregates + (p - 1) * tileHeight;
+	    for (size_t y = 0; y < rows; ++y) carryLine[y] += source[y];
+	    if (s == LOOKBACK_PREFIX) break;
+	  }
+	  for (size_t y = 0; y < rows; ++y) prefix[y] = carryLine[y] + aggregate[y];
+	  status[t].store(LOOKBACK_PREFIX, std::memory_order_release);
+
+	  // Fix-up with the last row of the tile above and the carry column
+	  if (ty > 0) {
+	    while (!done[t - tilesX].load(std::memory_order_acquire))
+	      std::this_thread::yield();
+	  }
+	  const integral_t *topLine = (ty > 0) ? integral.getLine(y0 - 1, z) + x0 : (const integral_t *)zeroLine;
+	  for (size_t y = 0; y < rows; ++y) {
+	    integral_t *intLine = integral.getLine(y0 + y, z) + x0;
+	    const integral_t left = carryLine[y];
+	    for (size_t x = 0; x < cols; ++x) intLine[x] += topLine[x] + left;
+	  }
+	  done[t].store(true, std::memory_order_release);
+	}
+
+	getDefaultBufferPool().release((uint8_t *)carryLine, tileHeight * sizeof(integral_t));
+      });
+  }
+
+  getDefaultBufferPool().release((uint8_t *)prefixes, bytes4edges);
+  getDefaultBufferPool().release((uint8_t *)aggregates, bytes4edges);
+  getDefaultBufferPool().release((uint8_t *)done, bytes4done);
+  getDefaultBufferPool().release((uint8_t *)status, bytes4status);
+  getDefaultBufferPool().release(zeroLine, bytes4integral);
+}
@@ -0,0 +1,85 @@
+/*
+  Copyright (C) 2017 Hoyoung Lee
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+#include <cpixmap.hpp>
+#include <cexecutor.hpp>
+#include <integral_image.hpp>
+
+// Modular integral images.
+//
+// With unsigned integrals every integral is kept modulo 2^digits, and so
+// is the four-corner difference of a box. The difference is the exact sum
+// of the box as long as that sum fits, that is when
+//
+//   area(box) * max(pixel_t) <= max(integral_t)
+//
+// whatever the size of the image. For 8-bit pixels, a uint16_t integral
+// answers boxes of up to 257 pixels and a uint32_t one boxes of up to
+// 4096x4096, so a 100-megapixel frame needs neither a uint64_t integral
+// nor checkIntegral().
+
+// Largest box area whose sums a modular integral gives exactly
+template <typename pixel_t, typename integral_t>
+inline constexpr uint64_t getModularBoxArea(void)
+{
+  return (uint64_t)std::numeric_limits<integral_t>::max() / (uint64_t)std::numeric_limits<pixel_t>::max();
+}
+
+template <typename pixel_t, typename integral_t>
+inline void integratePixmapModular(cpixmap<pixel_t>& pixmap, cpixmap<integral_t>& integral,
+				   cexecutor& executor = getDefaultExecutor())
+{
+  static_assert(std::numeric_limits<pixel_t>::is_integer && !std::numeric_limits<pixel_t>::is_signed,
+		"Modular integrals need unsigned integer pixels");
+  static_assert(std::numeric_limits<integral_t>::is_integer && !std::numeric_limits<integral_t>::is_signed,
+		"Modular integrals need unsigned integrals, whose arithmetic wraps around");
+  static_assert(getModularBoxArea<pixel_t, integral_t>() >= 1, "The integral is narrower than the pixel");
+
+  integratePixmap(pixmap, integral, executor);
+}
+
+// Sum of the w x h box at (x, y) of a modular integral made from pixel_t
+// pixels. A box larger than getModularBoxArea() is refused and false is
+// returned, since its sum may have wrapped around.
+template <typename pixel_t, typename integral_t>
+inline bool sumModularBox(const cpixmap<integral_t>& integral, size_t x, size_t y, size_t w, size_t h,
+			  integral_t& sum, size_t z = 0)
+{
+  assert(x + w <= integral.getWidth() && y + h <= integral.getHeight());
+  if (w == 0 || h == 0) {
+    sum = 0;
+    return true;
+  }
+  if ((uint64_t)w * h > getModularBoxArea<pixel_t, integral_t>()) return false;
+
+  const integral_t *lastLine = integral.getLine(y + h - 1, z);
+  integral_t s = lastLine[x + w - 1];
+  if (x > 0) s -= lastLine[x - 1];
+  if (y > 0) {
+    const integral_t *topLine = integral.getLine(y - 1, z);
+    s -= topLine[x + w - 1];
+    if (x > 0) s += topLine[x - 1];
+  }
+  sum = s;
+  return true;
+}
@@ -17,72 +17,82 @@
 #pragma once
 
 #include <cassert>
-#include <iostream>
 #include <cstring>
 #include <cstdint>
-
-#include <cpixmap.hpp>
+#include <limits>
+#include <algorithm>
+#include <type_traits>
+
+// integral_image.dispatch.cpp defines INTEGRAL_KERNELS_ONLY and builds
+// the line kernels alone with the flags of each instruction set. The
+// pixmap, pool and executor inlines must not be compiled there: the
+// linker keeps any one of their copies, which may then be an AVX-512 one.
+#if !defined(INTEGRAL_KERNELS_ONLY)
+# include <cpixmap.hpp>
+# include <cbufferpool.hpp>
+# include <power_of_2.hpp>
+# include <cexecutor.hpp>
+#endif
 
 #if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
-# define MAX_VECTOR_SIZE 512
+# if !defined(MAX_VECTOR_SIZE)
+#  define MAX_VECTOR_SIZE 512
+# endif
 # include <vectorclass/vectorclass.h>
 # if INSTRSET < 2
 #  error "Unsupported x86-SIMD! Please comment USE_SIMD on!"
 # endif
+# include "integral_image.SIMD.hpp"
 #elif defined(__GNUC__) && defined (__ARM_NEON__)
 # include <arm_neon.h>
 #else
 # error "Undefined SIMD!"
 #endif
 
-inline void integratePixmap(cpixmap<int8_t>& pixmap, cpixmap<int32_t>& integral)
-{
-  assert(pixmap.isMatched(integral));
-  
-  size_t bytes4integral = ALIGN_BYTES(std::max(pixmap.getWidth(), pixmap.getHeight()) * sizeof(int32_t));
-  uint8_t *tempLine = new uint8_t[bytes4integral];
-  
-  // Vertically cumulative summation
-  for (size_t z = 0; z < pixmap.getBands(); ++z) {
-    std::memset(tempLine, 0, bytes4integral);
-    int32_t *sumLine = (int32_t *)tempLine;
+#if defined(INTEGRAL_SIMD_NAMESPACE)
+namespace INTEGRAL_SIMD_NAMESPACE {
+#endif
+#if defined(VCL_NAMESPACE)
+using namespace VCL_NAMESPACE;
+#endif
 
-    for (size_t y = 0; y < pixmap.getHeight(); ++y) {
-      int8_t *pixLine = pixmap.getLine(y, z);
-      int32_t *intLine = integral.getLine(y, z);
-#pragma omp parallel for
 #if defined(__x86_64__) || defined(__i386__)
-# if INSTRSET >= 9 // AVX512 - 512bits
-      for (size_t x = 0; x < pixmap.getWidth(); x += 16) {
-	Vec16i pixVec(pixLine[x+0], pixLine[x+1], pixLine[x+2], pixLine[x+3],
-		      pixLine[x+4], pixLine[x+5], pixLine[x+6], pixLine[x+7],
-		      pixLine[x+8], pixLine[x+9], pixLine[x+10], pixLine[x+11],
-		      pixLine[x+12], pixLine[x+13], pixLine[x+14], pixLine[x+15]);
-	Vec16i sumVec;
-	sumVec.load(&sumLine[x]);
-	sumVec += pixVec;
-	sumVec.store(&intLine[x]);
-      }
-# elif INSTRSET >= 8 // AVX2 - 256bits
-      for (size_t x = 0; x < pixmap.getWidth(); x += 8) {
-	Vec8i pixVec(pixLine[x+0], pixLine[x+1], pixLine[x+2], pixLine[x+3],
-		     pixLine[x+4], pixLine[x+5], pixLine[x+6], pixLine[x+7]);
-	Vec8i sumVec;
-	sumVec.load(&sumLine[x]);
-	sumVec += pixVec;
-	sumVec.store(&intLine[x]);
-      }
-# elif INSTRSET >= 2 // SSE2 - 128bits
-      for (size_t x = 0; x < pixmap.getWidth(); x += 4) {
-	Vec4i pixVec(pixLine[x+0], pixLine[x+1], pixLine[x+2], pixLine[x+3]);
-	Vec4i sumVec;
-	sumVec.load(&sumLine[x]);
-	sumVec += pixVec;
-	sumVec.store(&intLine[x]);
-      }
-# endif
+template <typename integral_t>
+inline void scanLine(integral_t *line, size_t width, std::true_type)
+{
+  scanLineSIMD(line, width);
+}
+
+template <typename integral_t>
+inline void scanLine(integral_t *line, size_t width, std::false_type)
+{
+  for (size_t x = 1; x < width; ++x) line[x] += line[x-1];
+}
+
+// Every pair of (pixel_t, integral_t) listed in simd_integrable gets the
+// vectorized vertical step of integral_image.SIMD.hpp.
+template <typename pixel_t, typename integral_t>
+inline void integrateVertically(const pixel_t *pixLine, const integral_t *sumLine, integral_t *intLine, size_t width, std::true_type)
+{
+  accumulateLineSIMD(pixLine, sumLine, intLine, width);
+}
+
+template <typename pixel_t, typename integral_t>
+inline void integrateVertically(const pixel_t *pixLine, const integral_t *sumLine, integral_t *intLine, size_t width, std::false_type)
+{
+  for (size_t x = 0; x < width; ++x) intLine[x] = sumLine[x] + (integral_t)pixLine[x];
+}
+
+template <typename pixel_t, typename integral_t>
+inline void integrateVertically(const pixel_t *pixLine, const integral_t *sumLine, integral_t *intLine, size_t width)
+{
+  integrateVertically(pixLine, sumLine, intLine, width, simd_integrable<pixel_t, integral_t>());
+}
 #elif defined(__ARM_NEON__)
-      for (size_t x = 0; x < pixmap.getWidth(); x += 8) {
+inline void integrateVertically(const int8_t *pixLine, const int32_t *sumLine, int32_t *intLine, size_t width)
+{
+  size_t x = 0;
+  for (; x + 8 <= width; x += 8) {
 	int8x8_t loadVec = vld1_s8((const int8_t *)(&pixLine[x]));
 	int16x8_t tempVec = vmovl_s8(loadVec);
 	// Lower 4 elements
@@ -95,113 +105,14 @@ inline void integratePixmap(cpixmap<int8_t>& pixmap, cpixmap<int32_t>& integral)
 	sumVec = vld1q_s32((const int32_t *)(&sumLine[x+4]));
 	sumVec = vaddw_s16(sumVec, pixVec);
 	vst1q_s32((int32_t *)(&intLine[x+4]), sumVec);
-      }
-#endif
-      sumLine = intLine;
-    }
-  }
-
-  // Horizontally cumulative summation
-  int32_t *intLine = (int32_t *)new uint8_t[bytes4integral];
-  for (size_t z = 0; z < integral.getBands(); ++z) {
-    int32_t *sumLine = (int32_t *)tempLine;
-    integral.readVLine(sumLine, integral.getHeight(), 0, 0, z);
-
-    for (size_t x = 1; x < integral.getWidth(); ++x) {
-      integral.readVLine(intLine, integral.getHeight(), x, 0, z);
-#pragma omp parallel for
-#if defined(__x86_64__) || defined(__i386__)
-# if INSTRSET >= 9 // AVX512 - 512bits
-      for (size_t y = 0; y < integral.getHeight(); y += 16) {
-	Vec16i pixVec;
-	pixVec.load(&intLine[y]);
-	Vec16i sumVec;
-	sumVec.load(&sumLine[y]);
-	sumVec += pixVec;
-	sumVec.store(&sumLine[y]);
-      }
-# elif INSTRSET >= 8 // AVX2 - 256bits
-      for (size_t y = 0; y < integral.getHeight(); y += 8) {
-	Vec8i pixVec;
-	pixVec.load(&intLine[y]);
-	Vec8i sumVec;      
-	sumVec.load(&sumLine[y]);
-	sumVec += pixVec;
-	sumVec.store(&sumLine[y]);
-      }
-# elif INSTRSET >= 2 // SSE2 - 128bits
-      for (size_t y = 0; y < integral.getHeight(); y += 4) {
-	Vec4i pixVec;
-	pixVec.load(&intLine[y]);
-	Vec4i sumVec;
-	sumVec.load(&sumLine[y]);
-	sumVec += pixVec;
-	sumVec.store(&sumLine[y]);
-      }
-# endif
-#elif defined(__ARM_NEON__)
-      for (size_t y = 0; y < pixmap.getHeight(); y += 4) {
-	int32x4_t pixVec = vld1q_s32((const int32_t *)&intLine[y]);
-	int32x4_t sumVec = vld1q_s32((const int32_t *)&sumLine[y]);
-	sumVec = vaddq_s32(sumVec, pixVec);
-	vst1q_s32((int32_t *)&sumLine[y], sumVec);
-      }
-#endif
-      integral.writeVLine(sumLine, integral.getHeight(), x, 0, z);
-    }
   }
-
-  delete [] intLine;
-  delete [] tempLine;
+  for (; x < width; ++x) intLine[x] = sumLine[x] + pixLine[x];
 }
 
-inline void integratePixmap(cpixmap<uint8_t>& pixmap, cpixmap<uint32_t>& integral)
+inline void integrateVertically(const uint8_t *pixLine, const uint32_t *sumLine, uint32_t *intLine, size_t width)
 {
-  assert(pixmap.isMatched(integral));
-  
-  size_t bytes4integral = ALIGN_BYTES(std::max(pixmap.getWidth(), pixmap.getHeight()) * sizeof(uint32_t));
-  uint8_t *tempLine = new uint8_t[bytes4integral];
-  
-  // Vertically cumulative summation
-  for (size_t z = 0; z < pixmap.getBands(); ++z) {
-    std::memset(tempLine, 0, bytes4integral);
-    uint32_t *sumLine = (uint32_t *)tempLine;
-    for (size_t y = 0; y < pixmap.getHeight(); ++y) {
-      uint8_t *pixLine = pixmap.getLine(y, z);
-      uint32_t *intLine = integral.getLine(y, z);
-#pragma omp parallel for
-#if defined(__x86_64__) || defined(__i386__)
-# if INSTRSET >= 9 // AVX512 - 512bits
-      for (size_t x = 0; x < pixmap.getWidth(); x += 16) {
-	Vec16ui pixVec(pixLine[x+0], pixLine[x+1], pixLine[x+2], pixLine[x+3],
-		       pixLine[x+4], pixLine[x+5], pixLine[x+6], pixLine[x+7],
-		       pixLine[x+8], pixLine[x+9], pixLine[x+10], pixLine[x+11],
-		       pixLine[x+12], pixLine[x+13], pixLine[x+14], pixLine[x+15]);
-	Vec16ui sumVec;
-	sumVec.load(&sumLine[x]);
-	sumVec += pixVec;
-	sumVec.store(&intLine[x]);
-      }
-# elif INSTRSET >= 8 // AVX2 - 256bits
-      for (size_t x = 0; x < pixmap.getWidth(); x += 8) {
-	Vec8ui pixVec(pixLine[x+0], pixLine[x+1], pixLine[x+2], pixLine[x+3],
-		      pixLine[x+4], pixLine[x+5], pixLine[x+6], pixLine[x+7]);
-	Vec8ui sumVec;
-	sumVec.load(&sumLine[x]);
-	sumVec += pixVec;
-	sumVec.store(&intLine[x]);
-      }
-# elif INSTRSET >= 2 // SSE2 - 128bits
-      for (size_t x = 0; x < pixmap.getWidth(); x += 4) {
-	Vec4ui pixVec(pixLine[x+0], pixLine[x+1], pixLine[x+2], pixLine[x+3]);
-	Vec4ui sumVec;
-	sumVec.load(&sumLine[x]);
-	sumVec += pixVec;
-	sumVec.store(&intLine[x]);
-      }
-# endif
-#elif defined(__ARM_NEON__)
-      for (size_t x = 0; x < pixmap.getWidth(); x += 8) {
+  size_t x = 0;
+  for (; x + 8 <= width; x += 8) {
 	uint8x8_t loadVec = vld1_u8((const uint8_t *)&pixLine[x]);
 	uint16x8_t tempVec = vmovl_u8(loadVec);
 	// Lower 4 elements
@@ -214,337 +125,38 @@ inline void integratePixmap(cpixmap<uint8_t>& pixmap, cpixmap<uint32_t>& integra
 	sumVec = vld1q_u32((const uint32_t *)&sumLine[x+4]);
 	sumVec = vaddw_u16(sumVec, pixVec);
 	vst1q_u32((uint32_t *)&intLine[x+4], sumVec);
-      }
-#endif
-      sumLine = intLine;
-    }
-  }
-  
-  // Horizontally cumulative summation
-  uint32_t *intLine = (uint32_t *)new uint8_t[bytes4integral];
-
-  for (size_t z = 0; z < integral.getBands(); ++z) {
-    uint32_t *sumLine = (uint32_t *)tempLine;
-    integral.readVLine(sumLine, integral.getHeight(), 0, 0, z);
-    for (size_t x = 1; x < integral.getWidth(); ++x) {
-      integral.readVLine(intLine, integral.getHeight(), x, 0, z);
-#pragma omp parallel for
-#if defined(__x86_64__) || defined(__i386__)
-# if INSTRSET >= 9 // AVX512 - 512bits
-      for (size_t y = 0; y < integral.getHeight(); y += 16) {
-	Vec16ui pixVec;
-	pixVec.load(&intLine[y]);
-	Vec16ui sumVec;
-	sumVec.load(&sumLine[y]);
-	sumVec += pixVec;
-	sumVec.store(&sumLine[y]);
-      }
-# elif INSTRSET >= 8 // AVX2 - 256bits
-      for (size_t y = 0; y < integral.getHeight(); y += 8) {
-	Vec8ui pixVec;
-	pixVec.load(&intLine[y]);
-	Vec8ui sumVec;
-	sumVec.load(&sumLine[y]);
-	sumVec += pixVec;
-	sumVec.store(&sumLine[y]);
-      }
-# elif INSTRSET >= 2 // SSE2 - 128bits
-      for (size_t y = 0; y < integral.getHeight(); y += 4) {
-	Vec4ui pixVec;
-	pixVec.load(&intLine[y]);
-	Vec4ui sumVec;
-	sumVec.load(&sumLine[y]);
-	sumVec += pixVec;
-	sumVec.store(&sumLine[y]);
-      }
-# endif
-#elif defined(__ARM_NEON__)
-      for (size_t y = 0; y < pixmap.getHeight(); y += 4) {
-	uint32x4_t pixVec = vld1q_u32((const uint16_t *)(&intLine[y]));
-	uint32x4_t sumVec = vld1q_u32((const uint32_t *)(&sumLine[y]));
-	sumVec = vaddq_u32(sumVec, pixVec);
-	vst1q_u32((uint32_t *)(&sumLine[y]), sumVec);
-      }
-#endif
-      integral.writeVLine(sumLine, integral.getHeight(), x, 0, z);
-    }
   }
-
-  delete [] intLine;
-  delete [] tempLine;
+  for (; x < width; ++x) intLine[x] = sumLine[x] + pixLine[x];
 }
 
-inline void integratePixmap(cpixmap<int16_t>& pixmap, cpixmap<int32_t>& integral)
+inline void integrateVertically(const int16_t *pixLine, const int32_t *sumLine, int32_t *intLine, size_t width)
 {
-  assert(pixmap.isMatched(integral));
-  
-  std::cout << "Warning!: Integral pixmap doesn't fully contain the result from image pixmap!" << std::endl;
-
-  size_t bytes4integral = ALIGN_BYTES(std::max(pixmap.getWidth(), pixmap.getHeight()) * sizeof(int32_t));
-  uint8_t *tempLine = new uint8_t[bytes4integral];
-  
-  // Vertically cumulative summation
-  for (size_t z = 0; z < pixmap.getBands(); ++z) {
-    std::memset(tempLine, 0, bytes4integral);
-    int32_t *sumLine = (int32_t *)tempLine;
-    for (size_t y = 0; y < pixmap.getHeight(); ++y) {
-      int16_t *pixLine = pixmap.getLine(y, z);
-      int32_t *intLine = integral.getLine(y, z);
-#pragma omp parallel for
-#if defined(__x86_64__) || defined(__i386__)
-# if INSTRSET >= 9 // AVX512 - 512bits
-      for (size_t x = 0; x < pixmap.getWidth(); x += 16) {
-	Vec16i pixVec(pixLine[x+0], pixLine[x+1], pixLine[x+2], pixLine[x+3],
-		      pixLine[x+4], pixLine[x+5], pixLine[x+6], pixLine[x+7],
-		      pixLine[x+8], pixLine[x+9], pixLine[x+10], pixLine[x+11],
-		      pixLine[x+12], pixLine[x+13], pixLine[x+14], pixLine[x+15]);
-	Vec16i sumVec;
-	sumVec.load(&sumLine[x]);
-	sumVec += pixVec;
-	sumVec.store(&intLine[x]);
-      }
-# elif INSTRSET >= 8 // AVX2 - 256bits
-      for (size_t x = 0; x < pixmap.getWidth(); x += 8) {
-	Vec8i pixVec(pixLine[x+0], pixLine[x+1], pixLine[x+2], pixLine[x+3],
-		     pixLine[x+4], pixLine[x+5], pixLine[x+6], pixLine[x+7]);
-	Vec8i sumVec;
-	sumVec.load(&sumLine[x]);
-	sumVec += pixVec;
-	sumVec.store(&intLine[x]);
-      }
-# elif INSTRSET >= 2 // SSE2 - 128bits
-      for (size_t x = 0; x < pixmap.getWidth(); x += 4) {
-	Vec4i pixVec(pixLine[x+0], pixLine[x+1], pixLine[x+2], pixLine[x+3]);
-	Vec4i sumVec;
-	sumVec.load(&sumLine[x]);
-	sumVec += pixVec;
-	sumVec.store(&intLine[x]);
-      }
-# endif
-#elif defined(__ARM_NEON__)
-      for (size_t x = 0; x < pixmap.getWidth(); x += 4) {
+  size_t x = 0;
+  for (; x + 4 <= width; x += 4) {
 	int16x4_t pixVec = vld1_s16((const int16_t *)&pixLine[x]);
 	int32x4_t sumVec = vld1q_s32((const int32_t *)&sumLine[x]);
 	sumVec = vaddw_s16(sumVec, pixVec);
 	vst1q_s32((int32_t *)&intLine[x], sumVec);
-      }
-#endif
-      sumLine = intLine;
-    }
-  }
-
-  // Horizontally cumulative summation
-  int32_t *intLine = (int32_t *)new uint8_t[bytes4integral];
-
-  for (size_t z = 0; z < integral.getBands(); ++z) {
-    int32_t *sumLine = (int32_t *)tempLine;
-    integral.readVLine(sumLine, integral.getHeight(), 0, 0, z);
-    for (size_t x = 1; x < integral.getWidth(); ++x) {
-      integral.readVLine(intLine, integral.getHeight(), x, 0, z);
-#pragma omp parallel for
-#if defined(__x86_64__) || defined(__i386__)
-# if INSTRSET >= 9 // AVX512 - 512bits
-      for (size_t y = 0; y < integral.getHeight(); y += 16) {
-	Vec16i pixVec;
-	pixVec.load(&intLine[y]);
-	Vec16i sumVec;
-	sumVec.load(&sumLine[y]);
-	sumVec += pixVec;
-	sumVec.store(&sumLine[y]);
-      }
-# elif INSTRSET >= 8 // AVX2 - 256bits
-      for (size_t y = 0; y < integral.getHeight(); y += 8) {
-	Vec8i pixVec;
-	pixVec.load(&intLine[y]);
-	Vec8i sumVec;
-	sumVec.load(&sumLine[y]);
-	sumVec += pixVec;
-	sumVec.store(&sumLine[y]);
-      }
-# elif INSTRSET >= 2 // SSE2 - 128bits
-      for (size_t y = 0; y < integral.getHeight(); y += 4) {
-	Vec4i pixVec;
-	pixVec.load(&intLine[y]);
-	Vec4i sumVec;
-	sumVec.load(&sumLine[y]);
-	sumVec += pixVec;
-	sumVec.store(&sumLine[y]);
-      }
-# endif
-#elif defined(__ARM_NEON__)
-      for (size_t y = 0; y < pixmap.getHeight(); y += 4) {
-	int32x4_t pixVec = vld1q_s32((const int32_t *)&intLine[y]);
-	int32x4_t sumVec = vld1q_s32((const int32_t *)&sumLine[y]);
-	sumVec = vaddq_s32(sumVec, pixVec);
-	vst1q_s32((int32_t *)&sumLine[y], sumVec);
-      }
-#endif
-      integral.writeVLine(sumLine, integral.getHeight(), x, 0, z);
-    }
   }
-
-  delete [] intLine;
-  delete [] tempLine;
+  for (; x < width; ++x) intLine[x] = sumLine[x] + pixLine[x];
 }
 
-inline void integratePixmap(cpixmap<uint16_t>& pixmap, cpixmap<uint32_t>& integral)
+inline void integrateVertically(const uint16_t *pixLine, const uint32_t *sumLine, uint32_t *intLine, size_t width)
 {
-  assert(pixmap.isMatched(integral));
-
-  std::cout << "Warning!: Integral pixmap doesn't fully contain the result from image pixmap!" << std::endl;
-
-  size_t bytes4integral = ALIGN_BYTES(std::max(pixmap.getWidth(), pixmap.getHeight()) * sizeof(uint32_t));
-  uint8_t *tempLine = new uint8_t[bytes4integral];
-  
-  // Vertically cumulative summation
-  for (size_t z = 0; z < pixmap.getBands(); ++z) {
-    std::memset(tempLine, 0, bytes4integral);
-    uint32_t *sumLine = (uint32_t *)tempLine;
-    for (size_t y = 0; y < pixmap.getHeight(); ++y) {
-      uint16_t *pixLine = pixmap.getLine(y, z);
-      uint32_t *intLine = integral.getLine(y, z);
-#pragma omp parallel for
-#if defined(__x86_64__) || defined(__i386__)
-# if INSTRSET >= 9 // AVX512 - 512bits
-      for (size_t x = 0; x < pixmap.getWidth(); x += 16) {
-	Vec16ui pixVec(pixLine[x+0], pixLine[x+1], pixLine[x+2], pixLine[x+3],
-		       pixLine[x+4], pixLine[x+5], pixLine[x+6], pixLine[x+7],
-		       pixLine[x+8], pixLine[x+9], pixLine[x+10], pixLine[x+11],
-		       pixLine[x+12], pixLine[x+13], pixLine[x+14], pixLine[x+15]);
-	Vec16ui sumVec;
-	sumVec.load(&sumLine[x]);
-	sumVec += pixVec;
-	sumVec.store(&intLine[x]);
-      }
-# elif INSTRSET >= 8 // AVX2 - 256bits
-      for (size_t x = 0; x < pixmap.getWidth(); x += 8) {
-	Vec8ui pixVec(pixLine[x+0], pixLine[x+1], pixLine[x+2], pixLine[x+3],
-		      pixLine[x+4], pixLine[x+5], pixLine[x+6], pixLine[x+7]);
-	Vec8ui sumVec;
-	sumVec.load(&sumLine[x]);
-	sumVec += pixVec;
-	sumVec.store(&intLine[x]);
-      }
-    
-# elif INSTRSET >= 2 // SSE2 - 128bits
-      for (size_t x = 0; x < pixmap.getWidth(); x += 4) {
-	Vec4ui pixVec(pixLine[x+0], pixLine[x+1], pixLine[x+2], pixLine[x+3]);
-	Vec4ui sumVec;
-	sumVec.load(&sumLine[x]);
-	sumVec += pixVec;
-	sumVec.store(&intLine[x]);
-      }
-# endif
-#elif defined(__ARM_NEON__)
-      for (size_t x = 0; x < pixmap.getWidth(); x += 4) {
+  size_t x = 0;
+  for (; x + 4 <= width; x += 4) {
 	uint16x4_t pixVec = vld1_u16((const uint16_t *)(&pixLine[x]));
 	uint32x4_t sumVec = vld1q_u32((const uint32_t *)(&sumLine[x]));
 	sumVec = vaddw_u16(sumVec, pixVec);
 	vst1q_u32((uint32_t *)(&intLine[x]), sumVec);
-      }
-#endif
-      sumLine = intLine;
-    }
-  }
-
-  // Horizontally cumulative summation
-  uint32_t *intLine = (uint32_t *)new uint8_t[bytes4integral];
-
-  for (size_t z = 0; z < integral.getBands(); ++z) {
-    uint32_t *sumLine = (uint32_t *)tempLine;
-    integral.readVLine(sumLine, integral.getHeight(), 0, 0, z);
-    for (size_t x = 1; x < integral.getWidth(); ++x) {
-      integral.readVLine(intLine, integral.getHeight(), x, 0, z);
-#pragma omp parallel for
-#if defined(__x86_64__) || defined(__i386__)
-# if INSTRSET >= 9 // AVX512 - 512bits
-      for (size_t y = 0; y < integral.getHeight(); y += 16) {
-	Vec16ui pixVec;
-	pixVec.load(&intLine[y]);
-	Vec16ui sumVec;
-	sumVec.load(&sumLine[y]);
-	sumVec += pixVec;
-	sumVec.store(&sumLine[y]);
-      }
-# elif INSTRSET >= 8 // AVX2 - 256bits
-      for (size_t y = 0; y < integral.getHeight(); y += 8) {
-	Vec8ui pixVec;
-	pixVec.load(&intLine[y]);
-	Vec8ui sumVec;
-	sumVec.load(&sumLine[y]);
-	sumVec += pixVec;
-	sumVec.store(&sumLine[y]);
-      }
-# elif INSTRSET >= 2 // SSE2 - 128bits
-      for (size_t y = 0; y < integral.getHeight(); y += 4) {
-	Vec4ui pixVec;
-	pixVec.load(&intLine[y]);
-	Vec4ui sumVec;
-	sumVec.load(&sumLine[y]);
-	sumVec += pixVec;
-	sumVec.store(&sumLine[y]);
-      }
-# endif
-#elif defined(__ARM_NEON__)
-      for (size_t y = 0; y < integral.getHeight(); y += 4) {
-	uint16x4_t pixVec = vld1q_u16((const uint32_t *)&intLine[y]);
-	uint32x4_t sumVec = vld1q_u32((const uint32_t *)&sumLine[y]);
-	sumVec = vaddq_u32(sumVec, pixVec);
-	vst1q_u32((uint32_t *)&sumLine[y], sumVec);
-      }
-#endif
-      integral.writeVLine(sumLine, integral.getHeight(), x, 0, z);
-    }
   }
-  
-  delete [] intLine;
-  delete [] tempLine;
+  for (; x < width; ++x) intLine[x] = sumLine[x] + pixLine[x];
 }
 
-inline void integratePixmap(cpixmap<int16_t>& pixmap, cpixmap<int64_t>& integral)
+inline void integrateVertically(const int16_t *pixLine, const int64_t *sumLine, int64_t *intLine, size_t width)
 {
-  assert(pixmap.isMatched(integral));
-
-  size_t bytes4integral = ALIGN_BYTES(std::max(pixmap.getWidth(), pixmap.getHeight()) * sizeof(int64_t));
-  uint8_t *tempLine = new uint8_t[bytes4integral];
-  
-  // Vertically cumulative summation  
-  for (size_t z = 0; z < pixmap.getBands(); ++z) {
-    std::memset(tempLine, 0, bytes4integral);
-    int64_t *sumLine = (int64_t *)tempLine;
-    for (size_t y = 0; y < pixmap.getHeight(); ++y) {
-      int16_t *pixLine = pixmap.getLine(y, z);
-      int64_t *intLine = integral.getLine(y, z);
-#pragma omp parallel for
-#if defined(__x86_64__) || defined(__i386__)
-# if INSTRSET >= 9 // AVX512 - 512bits
-      for (size_t x = 0; x < pixmap.getWidth(); x += 8) {
-	Vec8q pixVec(pixLine[x+0], pixLine[x+1], pixLine[x+2], pixLine[x+3],
-		     pixLine[x+4], pixLine[x+5], pixLine[x+6], pixLine[x+7]);
-	Vec8q sumVec;
-	sumVec.load(&sumLine[x]);
-	sumVec += pixVec;
-	sumVec.store(&intLine[x]);
-      }
-# elif INSTRSET >= 8 // AVX2 - 256bits
-      for (size_t x = 0; x < pixmap.getWidth(); x += 4) {
-	Vec4q pixVec(pixLine[x+0], pixLine[x+1], pixLine[x+2], pixLine[x+3]);
-	Vec4q sumVec;
-	sumVec.load(&sumLine[x]);
-	sumVec += pixVec;
-	sumVec.store(&intLine[x]);
-      }
-# elif INSTRSET >= 2 // SSE2 - 128bits
-      for (size_t x = 0; x < pixmap.getWidth(); x += 2) {
-	Vec2q pixVec(pixLine[x+0], pixLine[x+1]);
-	Vec2q sumVec;
-	sumVec.load(&sumLine[x]);
-	sumVec += pixVec;
-	sumVec.store(&intLine[x]);
-      }
-# endif
-#elif defined(__ARM_NEON__)
-      for (size_t x = 0; x < pixmap.getWidth(); x += 4) {
+  size_t x = 0;
+  for (; x + 4 <= width; x += 4) {
 	int16x4_t loadVec = vld1_s16((const int16_t *)&pixLine[x]);
 	int32x4_t tempVec = vmovl_s16(loadVec);
 	// Lower 2 elements
@@ -557,110 +169,14 @@ inline void integratePixmap(cpixmap<int16_t>& pixmap, cpixmap<int64_t>& integral
 	sumVec = vld1q_s64((const int64_t *)&sumLine[x+2]);
 	sumVec = vaddw_s32(sumVec, pixVec);
 	vst1q_s64((int64_t *)&intLine[x+2], sumVec);
-      }
-#endif
-      sumLine = intLine;
-    }
-  }
-
-  // Horizontally cumulative summation
-  int64_t *intLine = (int64_t *)new uint8_t[bytes4integral];
-
-  for (size_t z = 0; z < integral.getBands(); ++z) {
-    int64_t *sumLine = (int64_t *)tempLine;
-    integral.readVLine(sumLine, integral.getHeight(), 0, 0, z);
-    for (size_t x = 1; x < integral.getWidth(); ++x) {
-      integral.readVLine(intLine, integral.getHeight(), x, 0, z);
-#pragma omp parallel for
-#if defined(__x86_64__) || defined(__i386__)
-# if INSTRSET >= 9 // AVX512 - 512bits
-      for (size_t y = 0; y < integral.getHeight(); y += 8) {
-	Vec8q pixVec;
-	pixVec.load(&intLine[y]);
-	Vec8q sumVec;
-	sumVec.load(&sumLine[y]);
-	sumVec += pixVec;
-	sumVec.store(&sumLine[y]);
-      }
-# elif INSTRSET >= 8 // AVX2 - 256bits
-      for (size_t y = 0; y < integral.getHeight(); y += 4) {
-	Vec4q pixVec;
-	pixVec.load(&intLine[y]);
-	Vec4q sumVec;
-	sumVec.load(&sumLine[y]);
-	sumVec += pixVec;
-	sumVec.store(&sumLine[y]);
-      }
-# elif INSTRSET >= 2 // SSE2 - 128bits
-      for (size_t y = 0; y < integral.getHeight(); y += 2) {
-	Vec2q pixVec;
-	pixVec.load(&intLine[y]);
-	Vec2q sumVec;
-	sumVec.load(&sumLine[y]);
-	sumVec += pixVec;
-	sumVec.store(&sumLine[y]);
-      }
-# endif
-#elif defined(__ARM_NEON__)
-      for (size_t y = 0; y < pixmap.getHeight(); y += 2) {
-	int64x2_t pixVec = vld1q_s64((const int64_t *)&intLine[y]);
-	int64x2_t sumVec = vld1q_s64((const int64_t *)&sumLine[y]);
-	sumVec = vaddq_s64(sumVec, pixVec);
-	vst1q_s64((int64_t *)&sumLine[y], sumVec);
-      }
-#endif
-      integral.writeVLine(sumLine, integral.getHeight(), x, 0, z);
-    }
   }
-
-  delete [] intLine;
-  delete [] tempLine;
+  for (; x < width; ++x) intLine[x] = sumLine[x] + pixLine[x];
 }
 
-inline void integratePixmap(cpixmap<uint16_t>& pixmap, cpixmap<uint64_t>& integral)
+inline void integrateVertically(const uint16_t *pixLine, const uint64_t *sumLine, uint64_t *intLine, size_t width)
 {
-  assert(pixmap.isMatched(integral));
-
-  size_t bytes4integral = ALIGN_BYTES(std::max(pixmap.getWidth(), pixmap.getHeight()) * sizeof(uint64_t));
-  uint8_t *tempLine = new uint8_t[bytes4integral];
-  
-  // Vertically cumulative summation  
-  for (size_t z = 0; z < pixmap.getBands(); ++z) {
-    std::memset(tempLine, 0, bytes4integral);
-    uint64_t *sumLine = (uint64_t *)tempLine;
-    for (size_t y = 0; y < pixmap.getHeight(); ++y) {
-      uint16_t *pixLine = pixmap.getLine(y, z);
-      uint64_t *intLine = integral.getLine(y, z);
-#pragma omp parallel for
-#if defined(__x86_64__) || defined(__i386__)
-# if INSTRSET >= 9 // AVX512 - 512bits
-      for (size_t x = 0; x < pixmap.getWidth(); x += 8) {
-	Vec8uq pixVec(pixLine[x+0], pixLine[x+1], pixLine[x+2], pixLine[x+3],
-		      pixLine[x+4], pixLine[x+5], pixLine[x+6], pixLine[x+7]);
-	Vec8uq sumVec;
-	sumVec.load(&sumLine[x]);
-	sumVec += pixVec;
-	sumVec.store(&intLine[x]);
-      }
-# elif INSTRSET >= 8 // AVX2 - 256bits
-      for (size_t x = 0; x < pixmap.getWidth(); x += 4) {
-	Vec4uq pixVec(pixLine[x+0], pixLine[x+1], pixLine[x+2], pixLine[x+3]);
-	Vec4uq sumVec;
-	sumVec.load(&sumLine[x]);
-	sumVec += pixVec;
-	sumVec.store(&intLine[x]);
-      }
-# elif INSTRSET >= 2 // SSE2 - 128bits
-      for (size_t x = 0; x < pixmap.getWidth(); x += 2) {
-	Vec2uq pixVec(pixLine[x+0], pixLine[x+1]);
-	Vec2uq sumVec;
-	sumVec.load(&sumLine[x]);
-	sumVec += pixVec;
-	sumVec.store(&intLine[x]);
-      }
-# endif
-#elif defined(__ARM_NEON__)
-      for (size_t x = 0; x < pixmap.getWidth(); x += 4) {
+  size_t x = 0;
+  for (; x + 4 <= width; x += 4) {
 	uint16x4_t loadVec = vld1_u16((const uint16_t *)&pixLine[x]);
 	uint32x4_t tempVec = vmovl_u16(loadVec);
 	// Lower 2 elements
@@ -673,61 +189,71 @@ inline void integratePixmap(cpixmap<uint16_t>& pixmap, cpixmap<uint64_t>& integr
 	sumVec = vld1q_u64((const uint64_t *)&sumLine[x+2]);
 	sumVec = vaddw_u32(sumVec, pixVec);
 	vst1q_u64((uint64_t *)&intLine[x+2], sumVec);
-      }
-#endif
-      sumLine = intLine;
-    }
   }
-  // Horizontally cumulative summation
-  uint64_t *intLine = (uint64_t *)new uint8_t[bytes4integral];
+  for (; x < width; ++x) intLine[x] = sumLine[x] + pixLine[x];
+}
+
+template <typename pixel_t, typename integral_t>
+inline void integrateVertically(const pixel_t *pixLine, const integral_t *sumLine, integral_t *intLine, size_t width)
+{
+  for (size_t x = 0; x < width; ++x) intLine[x] = sumLine[x] + (integral_t)pixLine[x];
+}
+#endif
 
-  for (size_t z = 0; z < integral.getBands(); ++z) {
-    uint64_t *sumLine = (uint64_t *)tempLine;
-    integral.readVLine(sumLine, integral.getHeight(), 0, 0, z);
-    for (size_t x = 1; x < integral.getWidth(); ++x) {
-      integral.readVLine(intLine, integral.getHeight(), x, 0, z);
-#pragma omp parallel for
+#if !defined(INTEGRAL_KERNELS_ONLY)
+// The horizontal pass runs on whole rows, which are contiguous in memory,
+// instead of gathering one element per row for every column.
+template <typename integral_t>
+inline void integrateHorizontally(cpixmap<integral_t>& integral, cexecutor& executor = getDefaultExecutor())
+{
+  integral.detach();
+  const size_t height = integral.getHeight();
+  executor.parallelFor(0, integral.getBands() * height, [&](size_t r0, size_t r1) {
+      for (size_t r = r0; r < r1; ++r) {
+	integral_t *intLine = integral.getLine(r % height, r / height);
 #if defined(__x86_64__) || defined(__i386__)
-# if INSTRSET >= 9 // AVX512 - 512bits
-      for (size_t y = 0; y < integral.getHeight(); y += 8) {
-	Vec8uq pixVec;
-	pixVec.load(&intLine[y]);
-	Vec8uq sumVec;
-	sumVec.load(&sumLine[y]);
-	sumVec += pixVec;
-	sumVec.store(&sumLine[y]);
-      }
-# elif INSTRSET >= 8 // AVX2 - 256bits
-      for (size_t y = 0; y < integral.getHeight(); y += 4) {
-	Vec4uq pixVec;
-	pixVec.load(&intLine[y]);
-	Vec4uq sumVec;
-	sumVec.load(&sumLine[y]);
-	sumVec += pixVec;
-	sumVec.store(&sumLine[y]);
-      }
-# elif INSTRSET >= 2 // SSE2 - 128bits
-      for (size_t y = 0; y < integral.getHeight(); y += 2) {
-	Vec2uq pixVec;
-	pixVec.load(&intLine[y]);
-	Vec2uq sumVec;
-	sumVec.load(&sumLine[y]);
-	sumVec += pixVec;
-	sumVec.store(&sumLine[y]);
+	scanLine(intLine, integral.getWidth(), simd_scannable<integral_t>());
+#else
+	for (size_t x = 1; x < integral.getWidth(); ++x) intLine[x] += intLine[x-1];
+#endif
       }
-# endif
-#elif defined(__ARM_NEON__)
-      for (size_t y = 0; y < pixmap.getHeight(); y += 2) {
-	uint64x2_t pixVec = vld1q_u64((const uint64_t *)&intLine[y]);
-	uint64x2_t sumVec = vld1q_u64((const uint64_t *)&sumLine[y]);
-	sumVec = vaddq_u64(sumVec, pixVec);
-	vst1q_u64((uint64_t *)&sumLine[y], sumVec);
+    });
+}
+
+template <typename pixel_t, typename integral_t>
+inline void integratePixmap(cpixmap<pixel_t>& pixmap, cpixmap<integral_t>& integral,
+			    cexecutor& executor = getDefaultExecutor())
+{
+  assert(!std::numeric_limits<integral_t>::is_integer ||
+	 !(std::numeric_limits<pixel_t>::is_signed ^ std::numeric_limits<integral_t>::is_signed));
+  assert(pixmap.isMatched(integral));
+  integral.detach();
+
+  size_t bytes4integral = ALIGN_BYTES(pixmap.getWidth() * sizeof(integral_t));
+  uint8_t *tempLine = getDefaultBufferPool().acquire(bytes4integral);
+
+  std::memset(tempLine, 0, bytes4integral);
+
+  // Vertically cumulative summation, every chunk of columns down the band.
+  // The chunks start on multiples of 64 columns to keep the vectors aligned.
+  executor.parallelFor(0, pixmap.getWidth(), [&](size_t x0, size_t x1) {
+      for (size_t z = 0; z < pixmap.getBands(); ++z) {
+	const integral_t *sumLine = (const integral_t *)tempLine;
+	for (size_t y = 0; y < pixmap.getHeight(); ++y) {
+	  integral_t *intLine = integral.getLine(y, z);
+	  integrateVertically((const pixel_t *)pixmap.getLine(y, z) + x0, sumLine + x0, intLine + x0, x1 - x0);
+	  sumLine = intLine;
+	}
       }
+    }, 64);
+
+  // Horizontally cumulative summation, row by row
+  integrateHorizontally(integral, executor);
+
+  getDefaultBufferPool().release(tempLine, bytes4integral);
+}
 #endif
-      integral.writeVLine(sumLine, integral.getHeight(), x, 0, z);
-    }
-  }
-  
-  delete [] intLine;
-  delete [] tempLine;
+
+#if defined(INTEGRAL_SIMD_NAMESPACE)
 }
+#endif
@@ -18,65 +18,54 @@
 
 #include <cassert>
 #include <limits>
-#include <iostream>
 #include <cstring>
 #include <cstdint>
 #include <algorithm>
 #include <type_traits>
 
 #include <cpixmap.hpp>
+#include <cbufferpool.hpp>
 #include <power_of_2.hpp>
+#include <cexecutor.hpp>
+#include <integral_image.traits.hpp>
 
 #if !defined(USE_SIMD)
 
 template <typename pixel_t, typename integral_t>
-inline void integratePixmap(cpixmap<pixel_t>& pixmap, cpixmap<integral_t>& integral)
+inline void integratePixmap(cpixmap<pixel_t>& pixmap, cpixmap<integral_t>& integral,
+			    cexecutor& executor = getDefaultExecutor())
 {
-  assert(!(std::numeric_limits<pixel_t>::is_signed ^ std::numeric_limits<integral_t>::is_signed));
+  assert(!std::numeric_limits<integral_t>::is_integer ||
+	 !(std::numeric_limits<pixel_t>::is_signed ^ std::numeric_limits<integral_t>::is_signed));
   assert(pixmap.isMatched(integral));
+  integral.detach();
 
-  if (std::numeric_limits<integral_t>::digits <
-      (std::numeric_limits<pixel_t>::digits +
-       ilog2(ceilPowerOf2((uint32_t)pixmap.getWidth())) +
-       ilog2(ceilPowerOf2((uint32_t)pixmap.getHeight())))) {
-    std::cout << "Warning!: Integral pixmap doesn't fully contain the result from image pixmap!" << std::endl;
-  }
+  size_t bytes4integral = ALIGN_BYTES(pixmap.getWidth() * sizeof(integral_t));
+  uint8_t *tempLine = getDefaultBufferPool().acquire(bytes4integral);
+  std::memset(tempLine, 0, bytes4integral);
 
-  size_t bytes4integral = ALIGN_BYTES(std::max(pixmap.getWidth(), pixmap.getHeight()) * sizeof(integral_t));
-  uint8_t *tempLine = new uint8_t[bytes4integral];
-  
-  // Vertically cumulative summation
-  for (size_t z = 0; z < pixmap.getBands(); ++z) {
-    std::memset(tempLine, 0, bytes4integral);
-    integral_t *sumLine = (integral_t *)tempLine;
-    for (size_t y = 0; y < pixmap.getHeight(); ++y) {
-      pixel_t *pixLine = pixmap.getLine(y, z);
-      integral_t *intLine = integral.getLine(y, z);
-#pragma omp parallel for
-      for (size_t x = 0; x < pixmap.getWidth(); ++x) {
-	intLine[x] = sumLine[x] + (integral_t)pixLine[x];
+  // Vertically cumulative summation, every chunk of columns down the band
+  executor.parallelFor(0, pixmap.getWidth(), [&](size_t x0, size_t x1) {
+      for (size_t z = 0; z < pixmap.getBands(); ++z) {
+	const integral_t *sumLine = (const integral_t *)tempLine;
+	for (size_t y = 0; y < pixmap.getHeight(); ++y) {
+	  const pixel_t *pixLine = pixmap.getLine(y, z);
+	  integral_t *intLine = integral.getLine(y, z);
+	  for (size_t x = x0; x < x1; ++x) intLine[x] = sumLine[x] + (integral_t)pixLine[x];
+	  sumLine = intLine;
+	}
       }
-      sumLine = intLine;
-    }
-  }
+    }, 16);
 
-  // Horizontally cumulative summation
-  integral_t *intLine = (integral_t *)new uint8_t[bytes4integral];
-  for (size_t z = 0; z < integral.getBands(); ++z) {
-    integral_t *sumLine = (integral_t *)tempLine;
-    integral.readVLine(sumLine, integral.getHeight(), 0, 0, z);
-    for (size_t x = 1; x < integral.getWidth(); ++x) {
-      integral.readVLine(intLine, integral.getHeight(), x, 0, z);
-#pragma omp parallel for
-      for (size_t y = 0; y < integral.getHeight(); ++y) {
-	sumLine[y] = sumLine[y] + intLine[y];
+  // Horizontally cumulative summation, row by row on contiguous memory
+  executor.parallelFor(0, integral.getBands() * integral.getHeight(), [&](size_t r0, size_t r1) {
+      for (size_t r = r0; r < r1; ++r) {
+	integral_t *intLine = integral.getLine(r % integral.getHeight(), r / integral.getHeight());
+	for (size_t x = 1; x < integral.getWidth(); ++x) intLine[x] += intLine[x-1];
       }
-      integral.writeVLine(sumLine, integral.getHeight(), x, 0, z);
-    }
-  }
+    });
 
-  delete [] intLine;
-  delete [] tempLine;
+  getDefaultBufferPool().release(tempLine, bytes4integral);
 }
 
 #else
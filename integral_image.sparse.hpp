@@ -0,0 +1,151 @@
+/*
+  Copyright (C) 2017 Hoyoung Lee
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cassert>
+#include <limits>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#include <cpixmap.hpp>
+#include <cbufferpool.hpp>
+#include <cexecutor.hpp>
+#include <csparseintegral.hpp>
+#include <integral_image.hpp>
+
+// True when all the bits of the line are zero. Negative zeros count as
+// non-zero pixels, which costs a local SAT but no accuracy.
+inline bool isZeroLine(const uint8_t *p, size_t bytes)
+{
+#if defined(USE_SIMD) && (defined(__x86_64__) || defined(__i386__))
+  return isZeroLineSIMD(p, bytes);
+#else
+  uint64_t orWord = 0;
+  size_t i = 0;
+  for (; i + 8 <= bytes; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, p + i, 8);
+    orWord |= word;
+  }
+  for (; i < bytes; ++i) orWord |= p[i];
+  return orWord == 0;
+#endif
+}
+
+// Integrates a pixmap into a csparseintegral. Every tile is tested with an
+// OR over its rows, which stops at the first non-zero row, and only the
+// occupied tiles take the integration of their pixels. The rest of the
+// work is on above() and left(), that is one integral per row of a tile
+// row and per column of a tile row, so the build time follows the
+// occupied area plus a read of the pixels. The tile rows are independent
+// but for their above() rows, which are summed down in a second pass as
+// in integratePixmapFloat().
+template <typename pixel_t, typename integral_t>
+inline void integratePixmapSparse(cpixmap<pixel_t>& pixmap, csparseintegral<integral_t>& integral,
+				  cexecutor& executor = getDefaultExecutor())
+{
+  assert(!std::numeric_limits<integral_t>::is_integer ||
+	 !(std::numeric_limits<pixel_t>::is_signed ^ std::numeric_limits<integral_t>::is_signed));
+  assert(integral.isMatched(pixmap));
+
+  const size_t width = pixmap.getWidth(), height = pixmap.getHeight();
+  const size_t n = integral.getTileSize(), tilesX = integral.getTilesX(), tilesY = integral.getTilesY();
+  if (width == 0 || height == 0) return;
+
+  executor.parallelFor(0, pixmap.getBands() * tilesY, [&](size_t s0, size_t s1) {
+      // The row sums, the zero line of a tile and the occupancy of a tile row
+      const size_t bytes4sums = n * tilesX * sizeof(integral_t), bytes4zero = n * sizeof(integral_t);
+      uint8_t *scratch = getDefaultBufferPool().acquire(bytes4sums + bytes4zero + tilesX);
+      integral_t *rowSums = (integral_t *)scratch;
+      integral_t *zeroLine = (integral_t *)(scratch + bytes4sums);
+      bool *occupied = (bool *)(scratch + bytes4sums + bytes4zero);
+      std::fill(zeroLine, zeroLine + n, integral_t(0));
+
+      for (size_t s = s0; s < s1; ++s) {
+	const size_t z = s / tilesY, ty = s % tilesY;
+	const size_t y0 = ty * n, rows = std::min(n, height - y0);
+
+	for (size_t tx = 0; tx < tilesX; ++tx) {
+	  const size_t x0 = tx * n, cols = std::min(n, width - x0);
+	  occupied[tx] = false;
+	  for (size_t j = 0; j < rows && !occupied[tx]; ++j)
+	    occupied[tx] = !isZeroLine((const uint8_t *)(pixmap.getLine(y0 + j, z) + x0), cols * sizeof(pixel_t));
+	}
+	integral.setOccupancy(ty, z, occupied);
+
+	// Local SATs of the occupied tiles, tile by tile so that the rows of
+	// a tile are written one after the other, and their row sums
+	for (size_t tx = 0; tx < tilesX; ++tx) {
+	  integral_t *tile = integral.getTile(tx, ty, z);
+	  if (!tile) {
+	    for (size_t j = 0; j < rows; ++j) rowSums[j * tilesX + tx] = 0;
+	    continue;
+	  }
+	  const size_t x0 = tx * n, cols = std::min(n, width - x0);
+	  const integral_t *prevLine = zeroLine;
+	  for (size_t j = 0; j < rows; ++j) {
+	    integral_t *localLine = tile + j * n;
+	    integrateLine(pixmap.getLine(y0 + j, z) + x0, prevLine, localLine, cols);
+	    rowSums[j * tilesX + tx] = localLine[cols - 1] - prevLine[cols - 1];
+	    prevLine = localLine;
+	  }
+	}
+
+	// left() from the row sums of the tiles on the left
+	const integral_t *prevLeft = NULL;
+	for (size_t j = 0; j < rows; ++j) {
+	  integral_t *leftLine = integral.getLeftLine(y0 + j, z);
+	  integral_t sum = 0;
+	  for (size_t tx = 0; tx < tilesX; ++tx) {
+	    leftLine[tx] = (prevLeft ? prevLeft[tx] : integral_t(0)) + sum;
+	    sum += rowSums[j * tilesX + tx];
+	  }
+	  prevLeft = leftLine;
+	}
+
+	// The bottom row of the tile row alone, summed down below
+	if (ty + 1 < tilesY) {
+	  integral_t *bottomLine = integral.getAboveLine(ty + 1, z);
+	  for (size_t tx = 0; tx < tilesX; ++tx) {
+	    const size_t x0 = tx * n, cols = std::min(n, width - x0);
+	    const integral_t left = prevLeft[tx];
+	    const integral_t *tile = integral.getTile(tx, ty, z);
+	    if (tile) {
+	      const integral_t *localLine = tile + (rows - 1) * n;
+	      for (size_t i = 0; i < cols; ++i) bottomLine[x0 + i] = left + localLine[i];
+	    } else {
+	      std::fill(bottomLine + x0, bottomLine + x0 + cols, left);
+	    }
+	  }
+	}
+      }
+
+      getDefaultBufferPool().release(scratch, bytes4sums + bytes4zero + tilesX);
+    });
+
+  executor.parallelFor(0, width, [&](size_t x0, size_t x1) {
+      for (size_t z = 0; z < pixmap.getBands(); ++z) {
+	std::fill(integral.getAboveLine(0, z) + x0, integral.getAboveLine(0, z) + x1, integral_t(0));
+	for (size_t ty = 2; ty < tilesY; ++ty) {
+	  integral_t *aboveLine = integral.getAboveLine(ty, z);
+	  const integral_t *prevLine = integral.getAboveLine(ty - 1, z);
+	  for (size_t x = x0; x < x1; ++x) aboveLine[x] += prevLine[x];
+	}
+      }
+    }, 64);
+}
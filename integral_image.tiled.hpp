@@ -0,0 +1,114 @@
+/*
+  Copyright (C) 2017 Hoyoung Lee
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cassert>
+#include <limits>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#include <cpixmap.hpp>
+#include <cbufferpool.hpp>
+#include <cexecutor.hpp>
+#include <integral_image.hpp>
+
+// Cache-blocked summed-area table.
+//
+// The band is walked in strips of tileHeight rows, and every strip in tiles
+// of tileWidth columns. A tile first gets its local SAT, which stays in
+// L1/L2, then its right edge is accumulated into the carry column of the
+// strip, and finally the carries are added while the tile is still hot:
+//
+//   I(x, y) = local(x, y) + I(x, y0-1) + (I(x0-1, y) - I(x0-1, y0-1))
+//
+// where I(x, y0-1) is the last row of the strip above and the bracket is
+// the carry column collected from the tiles on the left.
+
+#define INTEGRAL_TILE_BYTES (128*1024) // half of a typical L2
+
+// Model, not a measurement, of the bytes moved to or from memory per pixel,
+// assuming that a tile and its carries stay in cache: one read of the pixel,
+// one write of the integral, one read of the row above per strip and the
+// carry column per tile. Hardware counters are the only way to measure the
+// actual traffic; this is what the tile shape is chosen against.
+template <typename pixel_t, typename integral_t>
+inline double getTiledTrafficModel(size_t tileWidth, size_t tileHeight)
+{
+  return sizeof(pixel_t) + sizeof(integral_t) +
+    (double)sizeof(integral_t) / tileHeight +
+    2.0 * sizeof(integral_t) / tileWidth;
+}
+
+// Returns getTiledTrafficModel() for the tile shape actually used, which
+// depends on the band when tileWidth is 0.
+template <typename pixel_t, typename integral_t>
+inline double integratePixmapTiled(cpixmap<pixel_t>& pixmap, cpixmap<integral_t>& integral,
+				   size_t tileWidth = 0, size_t tileHeight = 64,
+				   cexecutor& executor = getDefaultExecutor())
+{
+  assert(!std::numeric_limits<integral_t>::is_integer ||
+	 !(std::numeric_limits<pixel_t>::is_signed ^ std::numeric_limits<integral_t>::is_signed));
+  assert(pixmap.isMatched(integral));
+  integral.detach();
+
+  const size_t width = pixmap.getWidth(), height = pixmap.getHeight();
+  if (width == 0 || height == 0) return 0.0;
+
+  tileHeight = std::max<size_t>(1, std::min(tileHeight, height));
+  if (tileWidth == 0) tileWidth = INTEGRAL_TILE_BYTES / (tileHeight * sizeof(integral_t));
+  tileWidth = std::max<size_t>(1, std::min(tileWidth, width));
+
+  size_t bytes4integral = ALIGN_BYTES(width * sizeof(integral_t));
+  uint8_t *zeroLine = getDefaultBufferPool().acquire(bytes4integral);
+  std::memset(zeroLine, 0, bytes4integral);
+
+  executor.parallelFor(0, pixmap.getBands(), [&](size_t z0, size_t z1) {
+      for (size_t z = z0; z < z1; ++z) {
+	integral_t *leftLine = (integral_t *)getDefaultBufferPool().acquire(tileHeight * sizeof(integral_t));
+
+	for (size_t y0 = 0; y0 < height; y0 += tileHeight) {
+	  const size_t rows = std::min(tileHeight, height - y0);
+	  const integral_t *topLine = (y0 == 0) ? (const integral_t *)zeroLine : integral.getLine(y0 - 1, z);
+	  std::fill(leftLine, leftLine + rows, integral_t(0));
+
+	  for (size_t x0 = 0; x0 < width; x0 += tileWidth) {
+	    const size_t cols = std::min(tileWidth, width - x0);
+
+	    // Local SAT of the tile
+	    integrateBlock(pixmap, integral, x0, cols, y0, rows, z, (const integral_t *)zeroLine);
+
+	    // Fix-up with the row above and the carry column, then carry the
+	    // right edge over to the next tile
+	    for (size_t y = 0; y < rows; ++y) {
+	      integral_t *intLine = integral.getLine(y0 + y, z) + x0;
+	      const integral_t left = leftLine[y];
+	      const integral_t right = intLine[cols - 1];
+	      for (size_t x = 0; x < cols; ++x) intLine[x] += topLine[x0 + x] + left;
+	      leftLine[y] = left + right;
+	    }
+	  }
+	}
+
+	getDefaultBufferPool().release((uint8_t *)leftLine, tileHeight * sizeof(integral_t));
+      }
+    });
+
+  getDefaultBufferPool().release(zeroLine, bytes4integral);
+
+  return getTiledTrafficModel<pixel_t, integral_t>(tileWidth, tileHeight);
+}
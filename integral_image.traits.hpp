@@ -0,0 +1,165 @@
+/*
+  Copyright (C) 2017 Hoyoung Lee
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+#include <cpixmap.hpp>
+
+#if defined(USE_SIMD) && (defined(__x86_64__) || defined(__i386__))
+# include "integral_image.SIMD.hpp"
+#endif
+
+// Choice of the integral type and overflow detection.
+//
+// An integral never exceeds (maximum pixel) * width * height, so it fits
+// when digits(pixel_t) + ceil(log2(width)) + ceil(log2(height)) bits fit
+// in integral_t. integral_for<> applies that bound at compile time to the
+// largest image a program handles:
+//
+//   typedef integral_for<uint8_t, 4096, 4096>::type integral_t; // uint32_t
+//
+// checkIntegral() looks at the data after the integration, for images
+// which break the bound but whose actual sums may still fit.
+
+#if defined(__SIZEOF_INT128__)
+// For the sums beyond 64 bits, like 32-bit pixels on a 100k x 100k mosaic
+typedef __int128 int128_t;
+typedef unsigned __int128 uint128_t;
+#endif
+
+inline constexpr int ceilLog2(size_t n)
+{
+  return (n <= 1) ? 0 : 1 + ceilLog2((n + 1) / 2);
+}
+
+inline constexpr int getIntegralBits(int pixelDigits, size_t width, size_t height)
+{
+  return pixelDigits + ceilLog2(width) + ceilLog2(height);
+}
+
+template <typename pixel_t, size_t maxWidth, size_t maxHeight>
+struct integral_for {
+  static constexpr int bits = getIntegralBits(std::numeric_limits<pixel_t>::digits, maxWidth, maxHeight);
+  typedef typename std::conditional<std::numeric_limits<pixel_t>::is_signed, int32_t, uint32_t>::type narrow_t;
+#if defined(__SIZEOF_INT128__)
+  typedef typename std::conditional<std::numeric_limits<pixel_t>::is_signed, int64_t, uint64_t>::type middle_t;
+  typedef typename std::conditional<std::numeric_limits<pixel_t>::is_signed, int128_t, uint128_t>::type wide_t;
+  typedef typename std::conditional<bits <= std::numeric_limits<middle_t>::digits, middle_t, wide_t>::type upper_t;
+#else
+  typedef typename std::conditional<std::numeric_limits<pixel_t>::is_signed, int64_t, uint64_t>::type wide_t;
+  typedef wide_t upper_t;
+#endif
+  typedef typename std::conditional<!std::numeric_limits<pixel_t>::is_integer, double,
+    typename std::conditional<bits <= std::numeric_limits<narrow_t>::digits, narrow_t, upper_t>::type>::type type;
+
+  static_assert(!std::numeric_limits<pixel_t>::is_integer || bits <= std::numeric_limits<wide_t>::digits,
+		"No integral type is wide enough for these dimensions");
+};
+
+enum INTEGRAL_STATUS {
+  INTEGRAL_OK = 0,        // every integral is exact
+  INTEGRAL_OVERFLOW = 1,  // some integrals have wrapped around
+  INTEGRAL_UNCHECKED = 2  // the bound fails and the data can't tell
+};
+
+template <typename integral_t>
+inline bool isNondecreasingLine(const integral_t *line, size_t width, std::false_type)
+{
+  for (size_t x = 1; x < width; ++x) {
+    if (line[x] < line[x-1]) return false;
+  }
+  return true;
+}
+
+#if defined(USE_SIMD) && (defined(__x86_64__) || defined(__i386__))
+template <typename integral_t>
+inline bool isNondecreasingLine(const integral_t *line, size_t width, std::true_type)
+{
+  return isNondecreasingLineSIMD(line, width);
+}
+#endif
+
+template <typename integral_t>
+inline bool isNondecreasingLine(const integral_t *line, size_t width)
+{
+#if defined(USE_SIMD) && (defined(__x86_64__) || defined(__i386__))
+  // The vector lanes compare as unsigned integers
+  return isNondecreasingLine(line, width,
+			     std::integral_constant<bool, simd_scannable<integral_t>::value &&
+			     !std::numeric_limits<integral_t>::is_signed>());
+#else
+  return isNondecreasingLine(line, width, std::false_type());
+#endif
+}
+
+// For integrals of non-negative values: the last row is the running sum
+// of the column totals, so as long as a column total can't wrap, the
+// running sum can't wrap without the last row decreasing. And if the
+// bottom right integral is exact, so is every other one.
+template <typename integral_t>
+inline INTEGRAL_STATUS checkIntegral(const cpixmap<integral_t>& integral, int pixelDigits, bool pixelSigned)
+{
+  const size_t width = integral.getWidth(), height = integral.getHeight();
+  if (!std::numeric_limits<integral_t>::is_integer) return INTEGRAL_OK;
+  if (getIntegralBits(pixelDigits, width, height) <= std::numeric_limits<integral_t>::digits) return INTEGRAL_OK;
+  if (pixelSigned) return INTEGRAL_UNCHECKED;
+  if (getIntegralBits(pixelDigits, 1, height) > std::numeric_limits<integral_t>::digits) return INTEGRAL_UNCHECKED;
+
+  for (size_t z = 0; z < integral.getBands(); ++z) {
+    if (!isNondecreasingLine(integral.getLine(height - 1, z), width)) return INTEGRAL_OVERFLOW;
+  }
+  return INTEGRAL_OK;
+}
+
+// Opt-in check of an integral made by any of the integrators
+template <typename pixel_t, typename integral_t>
+inline INTEGRAL_STATUS checkIntegral(const cpixmap<pixel_t>& pixmap, const cpixmap<integral_t>& integral)
+{
+  assert(pixmap.isMatched(integral));
+  return checkIntegral(integral, std::numeric_limits<pixel_t>::digits, std::numeric_limits<pixel_t>::is_signed);
+}
+
+// Same for the squared integral of integratePixmapSquared(), whose values
+// are never negative.
+template <typename pixel_t, typename sq_integral_t>
+inline INTEGRAL_STATUS checkSquaredIntegral(const cpixmap<pixel_t>& pixmap, const cpixmap<sq_integral_t>& squared)
+{
+  assert(pixmap.isMatched(squared));
+  return checkIntegral(squared, 2 * std::numeric_limits<pixel_t>::digits, false);
+}
+
+// Sum of the pixels of the w x h box at (x, y), from four integrals
+template <typename integral_t>
+inline integral_t sumBox(const cpixmap<integral_t>& integral, size_t x, size_t y, size_t w, size_t h, size_t z = 0)
+{
+  assert(x + w <= integral.getWidth() && y + h <= integral.getHeight());
+  if (w == 0 || h == 0) return 0;
+
+  const integral_t *lastLine = integral.getLine(y + h - 1, z);
+  integral_t sum = lastLine[x + w - 1];
+  if (x > 0) sum -= lastLine[x - 1];
+  if (y > 0) {
+    const integral_t *topLine = integral.getLine(y - 1, z);
+    sum -= topLine[x + w - 1];
+    if (x > 0) sum += topLine[x - 1];
+  }
+  return sum;
+}
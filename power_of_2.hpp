@@ -19,8 +19,15 @@
 #include <iostream>
 #include <sstream>
 #include <cassert>
+#include <cstdint>
 #include <limits>
 
+// The 64-bit overloads take unsigned long long and unsigned long rather
+// than uint64_t, so that size_t and uint64_t both find an exact match
+// whether they are unsigned long (LP64) or unsigned long long (macOS,
+// LLP64). As with the builtins, the results for 0 are undefined but for
+// the power-of-2 roundings, and ceilPowerOf2() gives 0 past the top bit.
+
 inline size_t countLeadingZeros(uint8_t x)
 {
   //assert(std::numeric_limits<unsigned long>::digits == 32);
@@ -39,10 +46,15 @@ inline size_t countLeadingZeros(uint32_t x)
   return __builtin_clzl((unsigned long)x) - (std::numeric_limits<unsigned long>::digits-32);
 }
 
-inline size_t countLeadingZeros(uint64_t x)
+inline size_t countLeadingZeros(unsigned long long x)
 {
   //assert(std::numeric_limits<unsigned long long>::digits == 64);
-  return __builtin_clzll((unsigned long long)x) - (std::numeric_limits<unsigned long long>::digits-64);
+  return __builtin_clzll(x) - (std::numeric_limits<unsigned long long>::digits-64);
+}
+
+inline size_t countLeadingZeros(unsigned long x)
+{
+  return countLeadingZeros((unsigned long long)x) - (64-std::numeric_limits<unsigned long>::digits);
 }
 
 inline size_t countTrailingZeros(uint8_t x)
@@ -63,10 +75,15 @@ inline size_t countTrailingZeros(uint32_t x)
   return __builtin_ctzl((unsigned long)x);
 }
 
-inline size_t countTrailingZeros(uint64_t x)
+inline size_t countTrailingZeros(unsigned long long x)
 {
   //assert(std::numeric_limits<unsigned long long>::digits == 64);
-  return __builtin_ctzll((unsigned long long)x);
+  return __builtin_ctzll(x);
+}
+
+inline size_t countTrailingZeros(unsigned long x)
+{
+  return countTrailingZeros((unsigned long long)x);
 }
 
 inline size_t ilog2(uint8_t x)
@@ -84,9 +101,14 @@ inline size_t ilog2(uint32_t x)
   return ((std::numeric_limits<unsigned long>::digits - 1) - __builtin_clzl((unsigned long)x));
 }
 
-inline size_t ilog2(uint64_t x)
+inline size_t ilog2(unsigned long long x)
+{
+  return ((std::numeric_limits<unsigned long long>::digits - 1) - __builtin_clzll(x));
+}
+
+inline size_t ilog2(unsigned long x)
 {
-  return ((std::numeric_limits<unsigned long long>::digits - 1) - __builtin_clzll((unsigned long long)x));
+  return ilog2((unsigned long long)x);
 }
 
 // Reference: my.safaribooksonline.com/book/information-technology-and-software-development/0201914654/power-of-2-boundaries
@@ -121,7 +143,7 @@ inline uint32_t floorPowerOf2(uint32_t x) // aka flp2()
   return x - (x>>1);
 }
 
-inline uint64_t floorPowerOf2(uint64_t x) // aka flp2()
+inline unsigned long long floorPowerOf2(unsigned long long x) // aka flp2()
 {
   x = x | (x>>1);
   x = x | (x>>2);
@@ -133,6 +155,11 @@ inline uint64_t floorPowerOf2(uint64_t x) // aka flp2()
   return x - (x>>1);
 }
 
+inline unsigned long floorPowerOf2(unsigned long x) // aka flp2()
+{
+  return (unsigned long)floorPowerOf2((unsigned long long)x);
+}
+
 inline uint8_t ceilPowerOf2(uint8_t x) // aka clp2
 {
   x = x - 1;
@@ -166,7 +193,7 @@ inline uint32_t ceilPowerOf2(uint32_t x) // aka clp2
   return x+1;
 }
 
-inline uint64_t ceilPowerOf2(uint64_t x) // aka clp2
+inline unsigned long long ceilPowerOf2(unsigned long long x) // aka clp2
 {
   x = x - 1;
   x = x | (x>>1);
@@ -179,6 +206,11 @@ inline uint64_t ceilPowerOf2(uint64_t x) // aka clp2
   return x+1;
 }
 
+inline unsigned long ceilPowerOf2(unsigned long x) // aka clp2
+{
+  return (unsigned long)ceilPowerOf2((unsigned long long)x);
+}
+
 /*
 template <typename T>
 inline size_t countLeadingZeros(T x)
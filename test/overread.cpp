@@ -0,0 +1,205 @@
+/*
+  Copyright (C) 2017 Hoyoung Lee
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// The vector kernels must not read or write past the end of a row. Every
+// buffer here ends flush against a PROT_NONE guard page, so a single byte
+// too many faults. Linux only. Build it for every instruction set, from the
+// top directory (without -DUSE_SIMD for the scalar kernels):
+//
+// g++ -O2 -I. -DUSE_SIMD -msse2 test/overread.cpp -o overread.sse2 -pthread
+// g++ -O2 -I. -DUSE_SIMD -mavx2 -mfma test/overread.cpp -o overread.avx2 -pthread
+// g++ -O2 -I. -DUSE_SIMD -mavx512f -mavx512bw -mavx512dq -mavx512vl
+//     test/overread.cpp -o overread.avx512 -pthread
+//
+// It prints the failures, if any, and exits with EXIT_FAILURE on them.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <cpixmap.hpp>
+#include <cexecutor.hpp>
+#include <integral_image.hpp>
+
+// bytes at the end of whole pages, followed by a guard page
+class cguardedbuffer {
+public:
+  cguardedbuffer(size_t bytes)
+  {
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    m_mapped = ((bytes + page - 1) / page + 1) * page;
+    m_base = (uint8_t *)mmap(NULL, m_mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m_base == MAP_FAILED) {
+      std::perror("mmap");
+      std::exit(EXIT_FAILURE);
+    }
+    mprotect(m_base + m_mapped - page, page, PROT_NONE);
+    m_data = m_base + m_mapped - page - bytes;
+  }
+  ~cguardedbuffer(void) { munmap(m_base, m_mapped); }
+  template <typename T> T *getData(void) const { return reinterpret_cast<T *>(m_data); }
+
+private:
+  cguardedbuffer(const cguardedbuffer&);
+  cguardedbuffer& operator=(const cguardedbuffer&);
+
+  uint8_t *m_base;
+  uint8_t *m_data;
+  size_t m_mapped;
+};
+
+static int failures = 0;
+
+// Pixels and integral packed row after row, both ending on a guard page
+template <typename pixel_t, typename integral_t>
+void testIntegratePixmap(const char *name, size_t width, size_t height)
+{
+  cguardedbuffer pixels(width * height * sizeof(pixel_t));
+  cguardedbuffer integrals(width * height * sizeof(integral_t));
+  cpixmap<pixel_t> pixmap(pixels.getData<pixel_t>(), width, height, 1, width * sizeof(pixel_t));
+  cpixmap<integral_t> integral(integrals.getData<integral_t>(), width, height, 1, width * sizeof(integral_t));
+  for (size_t y = 0; y < height; ++y) {
+    for (size_t x = 0; x < width; ++x) pixmap.getPixel(x, y) = (pixel_t)((x * 7 + y * 13) % 97);
+  }
+
+  cserialexecutor executor;
+  integratePixmap(pixmap, integral, executor);
+
+  for (size_t y = 0; y < height; ++y) {
+    for (size_t x = 0; x < width; ++x) {
+      double sum = 0;
+      for (size_t j = 0; j <= y; ++j) {
+	for (size_t i = 0; i <= x; ++i) sum += (double)pixmap.getPixel(i, j);
+      }
+      if ((double)integral.getPixel(x, y) != sum) {
+	std::printf("FAIL integratePixmap %s %zu x %zu at (%zu, %zu)\n", name, width, height, x, y);
+	++failures;
+	return;
+      }
+    }
+  }
+}
+
+template <typename pixel_t, typename integral_t>
+void testIntegratePixmap(const char *name)
+{
+  for (size_t width = 1; width <= 70; ++width) testIntegratePixmap<pixel_t, integral_t>(name, width, 3);
+}
+
+#if defined(USE_SIMD)
+// The vertical step of the slow integrators, integral_image.slow.SIMD.hpp,
+// on a pixel row, a sum row and an integral row that all end on a guard page
+template <typename pixel_t, typename integral_t>
+void testAccumulateLine(const char *name)
+{
+  for (size_t width = 1; width <= 70; ++width) {
+    cguardedbuffer pixels(width * sizeof(pixel_t));
+    cguardedbuffer sums(width * sizeof(integral_t));
+    cguardedbuffer integrals(width * sizeof(integral_t));
+    pixel_t *pixLine = pixels.getData<pixel_t>();
+    integral_t *sumLine = sums.getData<integral_t>();
+    integral_t *intLine = integrals.getData<integral_t>();
+    for (size_t x = 0; x < width; ++x) {
+      pixLine[x] = (pixel_t)((x * 7) % 97);
+      sumLine[x] = (integral_t)(x * 3);
+    }
+
+    accumulateLineSIMD(pixLine, sumLine, intLine, width);
+
+    for (size_t x = 0; x < width; ++x) {
+      if (intLine[x] != (integral_t)(sumLine[x] + (integral_t)pixLine[x])) {
+	std::printf("FAIL accumulateLineSIMD %s width %zu at %zu\n", name, width, x);
+	++failures;
+	return;
+      }
+    }
+  }
+}
+
+#endif
+
+// A view over a frame handed over by the caller, of exactly
+// (height - 1) * stride + width pixels, and a region at its bottom-right
+// corner, so that the last pixel of either is the last byte of the memory
+template <typename pixel_t, typename integral_t>
+void testExternalView(const char *name)
+{
+  for (size_t width = 1; width <= 70; ++width) {
+    const size_t height = 4, stride = (width + 3) * sizeof(pixel_t);
+    cguardedbuffer frame((height - 1) * stride + width * sizeof(pixel_t));
+    cpixmap<pixel_t> view(frame.getData<pixel_t>(), width, height, 1, stride);
+    for (size_t y = 0; y < height; ++y) {
+      for (size_t x = 0; x < width; ++x) view.getPixel(x, y) = (pixel_t)((x * 5 + y * 11) % 89);
+    }
+
+    const size_t x0 = width / 3, y0 = 1;
+    cpixmap<pixel_t> roi = view.getView(cregion<size_t>(x0, y0, width - x0, height - y0));
+    cpixmap<integral_t> integral(view), roiIntegral(roi);
+    integratePixmap(view, integral);
+    integratePixmap(roi, roiIntegral);
+
+    const size_t x = width - 1, y = height - 1;
+    double sum = 0, roiSum = 0;
+    for (size_t j = 0; j <= y; ++j) {
+      for (size_t i = 0; i <= x; ++i) {
+	sum += (double)view.getPixel(i, j);
+	if (i >= x0 && j >= y0) roiSum += (double)view.getPixel(i, j);
+      }
+    }
+    if ((double)integral.getPixel(x, y) != sum || (double)roiIntegral.getPixel(x - x0, y - y0) != roiSum) {
+      std::printf("FAIL external view %s width %zu\n", name, width);
+      ++failures;
+      return;
+    }
+  }
+}
+
+int main(void)
+{
+  testIntegratePixmap<uint8_t, uint64_t>("u8->u64");
+  testIntegratePixmap<int8_t, int64_t>("s8->s64");
+  testIntegratePixmap<uint8_t, uint32_t>("u8->u32");
+  testIntegratePixmap<int8_t, int32_t>("s8->s32");
+  testIntegratePixmap<uint8_t, uint16_t>("u8->u16");
+  testIntegratePixmap<uint16_t, uint64_t>("u16->u64");
+  testIntegratePixmap<int16_t, int64_t>("s16->s64");
+  testIntegratePixmap<uint32_t, uint64_t>("u32->u64");
+  testIntegratePixmap<uint8_t, float>("u8->f32");
+  testIntegratePixmap<float, double>("f32->f64");
+  testIntegratePixmap<int32_t, double>("s32->f64");
+
+#if defined(USE_SIMD)
+  testAccumulateLine<uint8_t, uint64_t>("u8->u64");
+  testAccumulateLine<int8_t, int64_t>("s8->s64");
+  testAccumulateLine<uint8_t, uint32_t>("u8->u32");
+  testAccumulateLine<int16_t, int32_t>("s16->s32");
+  testAccumulateLine<uint16_t, uint64_t>("u16->u64");
+  testAccumulateLine<uint8_t, float>("u8->f32");
+  testAccumulateLine<float, double>("f32->f64");
+#endif
+
+  testExternalView<uint8_t, uint64_t>("u8->u64");
+  testExternalView<int8_t, int64_t>("s8->s64");
+  testExternalView<uint8_t, uint32_t>("u8->u32");
+  testExternalView<uint16_t, uint64_t>("u16->u64");
+  testExternalView<float, double>("f32->f64");
+
+  std::printf("%s\n", failures ? "FAILED" : "ok");
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}